@@ -0,0 +1,177 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#include "pebble.h"
+#include "main.h"
+#include "code_cache.h"
+#include "key_store.h"
+
+// Codes only change once per time step of their key, so each one is
+// generated at most once per step and every redraw in between reuses the
+// stored text. Codes are kept by page like the secrets in the key store,
+// for the KEY_PAGE_SLOTS pages used most recently. The codes of the next
+// step are made a few seconds early by code_cache_prefetch(), so the boundary
+// itself only copies them in.
+static char cached_codes[KEY_PAGE_SLOTS][KEY_PAGE_SIZE][VERIFICATION_CODE_LENGTH];
+static long cached_steps[KEY_PAGE_SLOTS][KEY_PAGE_SIZE]; // Step each code was made for, -1 for none
+static char next_codes[KEY_PAGE_SLOTS][KEY_PAGE_SIZE][VERIFICATION_CODE_LENGTH];
+static long next_steps[KEY_PAGE_SLOTS][KEY_PAGE_SIZE];
+static unsigned int cached_pages[KEY_PAGE_SLOTS]; // KEY_NO_PAGE when empty
+static unsigned int cached_used[KEY_PAGE_SLOTS];
+static unsigned int cache_clock;
+
+static void clear_slot(unsigned int slot, unsigned int page) {
+	cached_pages[slot] = page;
+	for (int i = 0; i < KEY_PAGE_SIZE; i++) {
+		cached_steps[slot][i] = -1;
+		next_steps[slot][i] = -1;
+	}
+}
+
+// Copies in the prefetched code when it was made for step
+static bool take_next_code(unsigned int slot, unsigned int i, long step) {
+	if (next_steps[slot][i] != step)
+		return false;
+
+	memcpy(cached_codes[slot][i], next_codes[slot][i], VERIFICATION_CODE_LENGTH);
+	cached_steps[slot][i] = step;
+	return true;
+}
+
+void code_cache_invalidate(void) {
+	for (int slot = 0; slot < KEY_PAGE_SLOTS; slot++)
+		clear_slot(slot, KEY_NO_PAGE);
+}
+
+// Slot holding the codes of a page, taking over the one used longest ago if
+// there is none
+static unsigned int cache_slot(unsigned int page) {
+	unsigned int slot = 0;
+	while (slot < KEY_PAGE_SLOTS && cached_pages[slot] != page)
+		slot++;
+
+	if (slot == KEY_PAGE_SLOTS) {
+		slot = 0;
+		for (unsigned int s = 1; s < KEY_PAGE_SLOTS; s++) {
+			if (cached_used[s] < cached_used[slot])
+				slot = s;
+		}
+		clear_slot(slot, page);
+	}
+
+	cached_used[slot] = ++cache_clock;
+	return slot;
+}
+
+// Time step of a key from the period kept in RAM, so that checking a code
+// needs no secret loaded
+static long key_step(unsigned int key_id, time_t timestamp) {
+	unsigned int period = key_store_period(key_id);
+	return timestamp / (period ? period : TIME_STEP_SECONDS);
+}
+
+// Number of keys on a page
+static unsigned int page_count(unsigned int page) {
+	unsigned int first = page * KEY_PAGE_SIZE;
+	if (first >= watch_otp_count)
+		return 0;
+	return watch_otp_count - first < KEY_PAGE_SIZE ? watch_otp_count - first : KEY_PAGE_SIZE;
+}
+
+// Brings the cached pages up to date, one batch per page, and returns true
+// when any codes changed so callers know to redraw. Those are the pages on
+// screen, other keys wait until they are shown. Secrets are only loaded for
+// pages with a code that was neither made nor prefetched.
+bool code_cache_fill(void) {
+	time_t now = getOtpTime(timezone_offset);
+	bool changed = false;
+
+	for (int slot = 0; slot < KEY_PAGE_SLOTS; slot++) {
+		if (cached_pages[slot] == KEY_NO_PAGE)
+			continue;
+
+		unsigned int first = cached_pages[slot] * KEY_PAGE_SIZE;
+		unsigned int count = page_count(cached_pages[slot]);
+		bool stale = false;
+		for (unsigned int i = 0; i < count; i++) {
+			long step = key_step(first + i, now);
+			if (cached_steps[slot][i] == step)
+				continue;
+			changed = true;
+			if (!take_next_code(slot, i, step))
+				stale = true;
+		}
+		if (!stale)
+			continue;
+
+		const OtpKey *keys = key_store_page(cached_pages[slot], &count);
+		INSTRUMENT_BEGIN(PROBE_CODE_BATCH);
+		generate_codes_batch(keys, count, now, cached_codes[slot]);
+		INSTRUMENT_END(PROBE_CODE_BATCH);
+		for (unsigned int i = 0; i < count; i++) {
+			if (cached_codes[slot][i][0] == '\0')
+				strcpy(cached_codes[slot][i], "000000");
+			cached_steps[slot][i] = key_step(first + i, now);
+		}
+	}
+	return changed;
+}
+
+// Makes the codes of the cached pages as they will be CODE_PREFETCH_SECONDS
+// from now, for keys whose next step starts before then. Only one page is
+// done per call, so calling it every second spreads the work over the
+// seconds before the boundary. Returns true when any codes were made.
+bool code_cache_prefetch(void) {
+	time_t later = getOtpTime(timezone_offset) + CODE_PREFETCH_SECONDS;
+
+	for (int slot = 0; slot < KEY_PAGE_SLOTS; slot++) {
+		if (cached_pages[slot] == KEY_NO_PAGE)
+			continue;
+
+		unsigned int first = cached_pages[slot] * KEY_PAGE_SIZE;
+		unsigned int count = page_count(cached_pages[slot]);
+		unsigned int i = 0;
+		while (i < count && (cached_steps[slot][i] == key_step(first + i, later) ||
+				next_steps[slot][i] == key_step(first + i, later)))
+			i++;
+		if (i == count)
+			continue;
+
+		const OtpKey *keys = key_store_page(cached_pages[slot], &count);
+		INSTRUMENT_BEGIN(PROBE_CODE_PREFETCH);
+		generate_codes_batch(keys, count, later, next_codes[slot]);
+		INSTRUMENT_END(PROBE_CODE_PREFETCH);
+		for (i = 0; i < count; i++) {
+			if (next_codes[slot][i][0] == '\0')
+				strcpy(next_codes[slot][i], "000000");
+			next_steps[slot][i] = key_step(first + i, later);
+		}
+		return true;
+	}
+	return false;
+}
+
+const char *code_cache_get(unsigned int key_id) {
+	if (key_id >= watch_otp_count)
+		return "000000";
+
+	time_t now = getOtpTime(timezone_offset);
+	unsigned int slot = cache_slot(key_id / KEY_PAGE_SIZE);
+	unsigned int i = key_id % KEY_PAGE_SIZE;
+	long step = key_step(key_id, now);
+
+	if (cached_steps[slot][i] != step && !take_next_code(slot, i, step)) {
+		const OtpKey *key = key_store_key(key_id);
+		INSTRUMENT_BEGIN(PROBE_CODE);
+		if (generateCodeAt(key, now, cached_codes[slot][i], VERIFICATION_CODE_LENGTH) != OTP_OK)
+			strcpy(cached_codes[slot][i], "000000");
+		INSTRUMENT_END(PROBE_CODE);
+		cached_steps[slot][i] = step;
+	}
+
+	return cached_codes[slot][i];
+}
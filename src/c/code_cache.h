@@ -0,0 +1,15 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+
+#define CODE_PREFETCH_SECONDS 5 // How long before a new time step its codes are made
+
+const char *code_cache_get(unsigned int key_id);
+bool code_cache_fill(void);
+bool code_cache_prefetch(void);
+void code_cache_invalidate(void);
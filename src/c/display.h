@@ -1,4 +1,21 @@
 #include <pebble.h>
-void draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen);
+
+// The countdown is looked up per slot of the key's period, 100ms each for
+// the usual 30 seconds. Each display builds its table at compile time by
+// expanding a SLOT(n) macro over every slot with COUNTDOWN_TABLE.
+#define COUNTDOWN_SLOTS 300
+#define COUNTDOWN_SLOTS_10(SLOT, n) SLOT(n), SLOT((n)+1), SLOT((n)+2), SLOT((n)+3), SLOT((n)+4), \
+	SLOT((n)+5), SLOT((n)+6), SLOT((n)+7), SLOT((n)+8), SLOT((n)+9)
+#define COUNTDOWN_SLOTS_100(SLOT, n) COUNTDOWN_SLOTS_10(SLOT, n), COUNTDOWN_SLOTS_10(SLOT, (n)+10), \
+	COUNTDOWN_SLOTS_10(SLOT, (n)+20), COUNTDOWN_SLOTS_10(SLOT, (n)+30), COUNTDOWN_SLOTS_10(SLOT, (n)+40), \
+	COUNTDOWN_SLOTS_10(SLOT, (n)+50), COUNTDOWN_SLOTS_10(SLOT, (n)+60), COUNTDOWN_SLOTS_10(SLOT, (n)+70), \
+	COUNTDOWN_SLOTS_10(SLOT, (n)+80), COUNTDOWN_SLOTS_10(SLOT, (n)+90)
+#define COUNTDOWN_TABLE(SLOT) { COUNTDOWN_SLOTS_100(SLOT, 0), COUNTDOWN_SLOTS_100(SLOT, 100), COUNTDOWN_SLOTS_100(SLOT, 200) }
+
+// Draws one frame of the countdown through a period of the given number of
+// seconds and returns the ms until it next changes on screen,
+// countdown_refresh_time while it is still catching up or sliding
+uint32_t draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen, unsigned int period);
+GRect countdown_graphic_frame(GRect display_bounds);
 void create_single_code_screen_elements(Layer **layer, GRect *text_label_rect, GRect *text_pin_rect, TextLayer **text_label_layer);
 void set_textlayer_positions(int font, GRect *text_label_rect, GRect *text_pin_rect);
\ No newline at end of file
@@ -4,30 +4,59 @@
 #include "display.h"
 #include "main.h"
 
-#define TIME_ANGLE(time) time * (TRIG_MAX_ANGLE / 30000)
+#define COUNTDOWN_THICKNESS 7
+// The target moves on a little every slot, so the ring counts as caught up
+// once it is within 3 degrees of it
+#define SETTLE_ANGLE (TRIG_MAX_ANGLE / 120)
+
+// Ring angle once slot n of the period has gone. It covers the same share
+// of the circle whatever the display size.
+#define RING_ANGLE(n) ((n) * (TRIG_MAX_ANGLE / COUNTDOWN_SLOTS))
+
+static const uint16_t ring_angles[COUNTDOWN_SLOTS] = COUNTDOWN_TABLE(RING_ANGLE);
 
 uint16_t thickness = 0;
 uint16_t c_angle = 0;
 
-void draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen) {
-	time_t temp = time(NULL);
-	struct tm *tick_time = localtime(&temp);
-	int seconds = ((tick_time->tm_sec % 30)*1000) + time_ms(NULL, NULL);
+// The ring runs round the edge, so it needs the whole display
+GRect countdown_graphic_frame(GRect display_bounds) {
+	return display_bounds;
+}
+
+uint32_t draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen, unsigned int period) {
+	GRect bounds = layer_get_bounds(*layer);
+	time_t now;
+	uint16_t milliseconds;
+	time_ms(&now, &milliseconds);
+	// Time zones are whole minutes, so UTC seconds line up with local ones
+	int period_ms = period * 1000;
+	int elapsed = ((now % period)*1000) + milliseconds;
+	int slot = (elapsed * COUNTDOWN_SLOTS) / period_ms;
+	uint16_t target_thickness = on_screen ? COUNTDOWN_THICKNESS : 0;
 
-	if (on_screen && thickness != 7)
+	if (thickness < target_thickness)
 		thickness++;
-	else if (!on_screen && thickness > 0)
+	else if (thickness > target_thickness)
 		thickness--;
 	
-	uint16_t target = (seconds*((TRIG_MAX_ANGLE*100)/30000))/100;
+	uint16_t target = ring_angles[slot];
+	int distance = target > c_angle ? target-c_angle : c_angle-target;
 	
-	if (target >= c_angle)
+	if (distance <= SETTLE_ANGLE)
+		c_angle = target;
+	else if (target > c_angle)
 		c_angle += ((target-c_angle)/6)+1;
 	else
 		c_angle -= ((c_angle-target)/6)+1;
 	
 	graphics_context_set_fill_color(*ctx, fg_color);
-	graphics_fill_radial(*ctx, layer_get_bounds(*layer), GOvalScaleModeFitCircle, thickness, 0, c_angle);
+	graphics_fill_radial(*ctx, bounds, GOvalScaleModeFitCircle, thickness, 0, c_angle);
+
+	if (thickness != target_thickness || distance > SETTLE_ANGLE)
+		return countdown_refresh_time;
+
+	// Nothing changes until the next slot
+	return (((slot+1) * period_ms + COUNTDOWN_SLOTS-1) / COUNTDOWN_SLOTS) - elapsed;
 }
 
 void create_single_code_screen_elements(Layer **layer, GRect *text_label_rect, GRect *text_pin_rect, TextLayer **text_label_layer) {
@@ -4,29 +4,63 @@
 #include "display.h"
 #include "main.h"
 
+#define COUNTDOWN_HEIGHT 10
+#define SETTLE_WIDTH 5 // about a second of movement
+
+#ifndef PBL_DISPLAY_WIDTH
+#define PBL_DISPLAY_WIDTH 144
+#endif
+
+// Bar width once slot n of the period has gone
+#define BAR_WIDTH(n) ((PBL_DISPLAY_WIDTH * (COUNTDOWN_SLOTS - (n))) / COUNTDOWN_SLOTS)
+
+static const uint8_t bar_widths[COUNTDOWN_SLOTS] = COUNTDOWN_TABLE(BAR_WIDTH);
+
 uint16_t thickness = 0;
 uint16_t c_size = 0;
 
-void draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen) {
-	GRect display_bounds = layer_get_frame(*layer);
-	time_t temp = time(NULL);
-	struct tm *tick_time = localtime(&temp);
-	int seconds = ((30 - (tick_time->tm_sec % 30))*1000) - time_ms(NULL, NULL);
-	int target_width = (((display_bounds.size.w*100) / 30) * seconds) / 100000;
+// The bar only ever covers the bottom strip of the display
+GRect countdown_graphic_frame(GRect display_bounds) {
+	return GRect(0, display_bounds.size.h-COUNTDOWN_HEIGHT, display_bounds.size.w, COUNTDOWN_HEIGHT);
+}
+
+uint32_t draw_countdown_graphic(Layer **layer, GContext **ctx, bool on_screen, unsigned int period) {
+	GRect bounds = layer_get_bounds(*layer);
+	time_t now;
+	uint16_t milliseconds;
+	time_ms(&now, &milliseconds);
+	// Time zones are whole minutes, so UTC seconds line up with local ones
+	int period_ms = period * 1000;
+	int elapsed = ((now % period)*1000) + milliseconds;
+	int slot = (elapsed * COUNTDOWN_SLOTS) / period_ms;
+	int target_width = bar_widths[slot];
+	uint16_t target_thickness = on_screen ? COUNTDOWN_HEIGHT : 0;
+	int distance = target_width > c_size ? target_width-c_size : c_size-target_width;
 
-	if (target_width >= c_size)
+	if (distance <= SETTLE_WIDTH)
+		c_size = target_width;
+	else if (target_width > c_size)
 		c_size += ((target_width-c_size)/6)+1;
-	else
+	else if (target_width < c_size)
 		c_size -= ((c_size-target_width)/6)+1;
 
-	if (on_screen && thickness != 10)
+	if (thickness < target_thickness)
 		thickness++;
-	else if (!on_screen && thickness > 0)
+	else if (thickness > target_thickness)
 		thickness--;
 
-	GRect countdown_rect = GRect(0, display_bounds.size.h-thickness, c_size, thickness);
+	GRect countdown_rect = GRect(0, bounds.size.h-thickness, c_size, thickness);
 	graphics_context_set_fill_color(*ctx, fg_color);
 	graphics_fill_rect(*ctx, countdown_rect, 0, GCornerNone);
+
+	if (thickness != target_thickness || distance > SETTLE_WIDTH)
+		return countdown_refresh_time;
+
+	// Nothing changes until the bar is due to lose another pixel
+	int next_slot = slot + 1;
+	while (next_slot < COUNTDOWN_SLOTS && bar_widths[next_slot] == target_width)
+		next_slot++;
+	return ((next_slot * period_ms + COUNTDOWN_SLOTS-1) / COUNTDOWN_SLOTS) - elapsed;
 }
 
 void create_single_code_screen_elements(Layer **layer, GRect *text_label_rect, GRect *text_pin_rect, TextLayer **text_label_layer) {
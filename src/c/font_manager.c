@@ -0,0 +1,78 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#include "pebble.h"
+#include "main.h"
+#include "font_manager.h"
+
+// A system font by key, or a custom one by resource when key is NULL. The pin
+// fonts are digit only subsets, see characterRegex in package.json.
+typedef struct {
+	const char *key;
+	uint32_t resource_id;
+} FontSource;
+
+static const FontSource label_sources[FONT_COUNT] = {
+	{ NULL, RESOURCE_ID_FONT_ORBITRON_28 },
+	{ FONT_KEY_GOTHIC_24, 0 },
+	{ NULL, RESOURCE_ID_FONT_DIGITAL_30 },
+	{ NULL, RESOURCE_ID_FONT_BD_CARTOON_20 }
+};
+
+static const FontSource pin_sources[FONT_COUNT] = {
+	{ NULL, RESOURCE_ID_FONT_BITWISE_32 },
+	{ FONT_KEY_BITHAM_34_MEDIUM_NUMBERS, 0 },
+	{ NULL, RESOURCE_ID_FONT_DIGITAL_42 },
+	{ NULL, RESOURCE_ID_FONT_BD_CARTOON_30 }
+};
+
+static GFont label_fonts[FONT_COUNT];
+static GFont pin_fonts[FONT_COUNT];
+
+static GFont get_font(const FontSource *sources, GFont *fonts, unsigned int font) {
+	if (font >= FONT_COUNT)
+		font = 0;
+
+	if (!fonts[font]) {
+		INSTRUMENT_BEGIN(PROBE_FONTS);
+		if (sources[font].key)
+			fonts[font] = fonts_get_system_font(sources[font].key);
+		else
+			fonts[font] = fonts_load_custom_font(resource_get_handle(sources[font].resource_id));
+		INSTRUMENT_END(PROBE_FONTS);
+	}
+	return fonts[font];
+}
+
+GFont font_manager_label(unsigned int font) {
+	return get_font(label_sources, label_fonts, font);
+}
+
+GFont font_manager_pin(unsigned int font) {
+	return get_font(pin_sources, pin_fonts, font);
+}
+
+// Font to draw a code in. Codes of 8 to 10 digits are too wide for the pin
+// fonts, so they are drawn in a small system font whatever the setting.
+GFont font_manager_code(unsigned int font, const char *code) {
+	if (strlen(code) > PIN_FONT_DIGITS)
+		return fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD);
+	return font_manager_pin(font);
+}
+
+static void unload_fonts(const FontSource *sources, GFont *fonts) {
+	for (int i = 0; i < FONT_COUNT; i++) {
+		if (fonts[i] && !sources[i].key)
+			fonts_unload_custom_font(fonts[i]);
+		fonts[i] = NULL;
+	}
+}
+
+void font_manager_unload(void) {
+	unload_fonts(label_sources, label_fonts);
+	unload_fonts(pin_sources, pin_fonts);
+}
@@ -0,0 +1,21 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+#include "pebble.h"
+
+#define FONT_COUNT 4 // Font settings offered in the phone config
+#define PIN_FONT_DIGITS 6 // Longest code every pin font fits across the screen
+
+// Every window gets its fonts from here. Each font is loaded the first time a
+// window asks for it and kept until font_manager_unload() when the app exits,
+// so switching layouts or windows never reads a font resource again. Font
+// settings outside the range fall back to the default, font 0.
+GFont font_manager_label(unsigned int font);
+GFont font_manager_pin(unsigned int font);
+GFont font_manager_code(unsigned int font, const char *code);
+void font_manager_unload(void);
\ No newline at end of file
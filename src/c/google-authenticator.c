@@ -24,21 +24,12 @@
 #include "base32.h"
 #include "hmac.h"
 #include "sha1.h"
+#include "sha2.h"
 #include "google-authenticator.h"
 
-char *generateCode(const char *key, int timezone_offset) {
-	
-	#ifdef PBL_SDK_2
-		long tm = (time(NULL) + (timezone_offset*60))/30;
-	#else
-		long tm = time(NULL)/30;
-	#endif
-		
-	uint8_t challenge[8];
-	for (int i = 8; i--; tm >>= 8) {
-		challenge[i] = tm;
-	}
-	
+bool prepareKey(const char *key, OtpKey *otp_key) {
+	otp_key->secret_length = 0;
+
 	// Estimated number of bytes needed to represent the decoded secret. Because
 	// of white-space and separators, this is an upper bound of the real number,
 	// which we later get as a return-value from base32_decode()
@@ -47,23 +38,103 @@ char *generateCode(const char *key, int timezone_offset) {
 	// Sanity check, that our secret will fixed into a reasonably-sized static
 	// array.
 	if (secretLen < 0 || secretLen > 100) {
-		return "000000";
+		return false;
 	}
 	
 	// Decode secret from Base32 to a binary representation, and check that we
 	// have at least one byte's worth of secret data.
 	uint8_t secret[100];
-	if ((secretLen = base32_decode((const uint8_t *)key, secret, secretLen))<1) {
-		return "000000";
+	if ((secretLen = base32_decode((const uint8_t *)key, secret, secretLen))<1 ||
+	    secretLen > MAX_SECRET_LENGTH) {
+		memset(secret, 0, sizeof(secret));
+		return false;
 	}
 
-	// Compute the HMAC_SHA1 of the secret and the challenge.
-	uint8_t hash[SHA1_DIGEST_LENGTH];
-	hmac_sha1(secret, secretLen, challenge, 8, hash, SHA1_DIGEST_LENGTH);
-	
+	prepareSecret(secret, secretLen, OTP_ALGORITHM_SHA1, OTP_DEFAULT_DIGITS, OTP_DEFAULT_PERIOD, otp_key);
+	memset(secret, 0, sizeof(secret));
+	return true;
+}
+
+// Whether prepareSecret() would accept a secret of this length and options
+bool validSecret(int secretLen, int algorithm, int digits, int period) {
+	return secretLen >= 1 && secretLen <= MAX_SECRET_LENGTH &&
+	       algorithm >= OTP_ALGORITHM_SHA1 && algorithm <= OTP_ALGORITHM_SHA512 &&
+	       digits >= OTP_MIN_DIGITS && digits <= OTP_MAX_DIGITS &&
+	       period >= 1 && period <= 255;
+}
+
+// Same as prepareKey() for a secret that is already in binary form, with the
+// options the key was issued with.
+bool prepareSecret(const uint8_t *secret, int secretLen, int algorithm, int digits, int period, OtpKey *otp_key) {
+	otp_key->secret_length = 0;
+	if (!validSecret(secretLen, algorithm, digits, period)) {
+		return false;
+	}
+
+	memcpy(otp_key->secret, secret, secretLen);
+	otp_key->secret_length = secretLen;
+	otp_key->algorithm = algorithm;
+	otp_key->digits = digits;
+	otp_key->period = period;
+
+	// Hash the inner and outer key pads now so each code only costs the
+	// compressions for the challenge.
+	if (algorithm == OTP_ALGORITHM_SHA1)
+		hmac_sha1_init_key(&otp_key->hmac.sha1, otp_key->secret, otp_key->secret_length);
+	else if (algorithm == OTP_ALGORITHM_SHA256)
+		hmac_sha256_init_key(&otp_key->hmac.sha256, otp_key->secret, otp_key->secret_length);
+	return true;
+}
+
+// Two keys match when their decoded secrets do, however the text was typed.
+bool sameSecret(const OtpKey *a, const OtpKey *b) {
+	return a->secret_length > 0 &&
+		a->secret_length == b->secret_length &&
+		memcmp(a->secret, b->secret, a->secret_length) == 0;
+}
+
+// Current time as used for the challenge. SDK 2 watches keep local time, so
+// the offset sent by the phone is needed to get back to UTC.
+time_t getOtpTime(int timezone_offset) {
+	#ifdef PBL_SDK_2
+		return time(NULL) + (timezone_offset*60);
+	#else
+		return time(NULL);
+	#endif
+}
+
+// Time step of the key containing timestamp. Keys that are not loaded yet
+// have no period and count in the default one.
+long getKeyStep(const OtpKey *otp_key, time_t timestamp) {
+	return timestamp / (otp_key->period ? otp_key->period : TIME_STEP_SECONDS);
+}
+
+static void encodeChallenge(long step, uint8_t challenge[8]) {
+	long tm = step;
+	for (int i = 8; i--; tm >>= 8) {
+		challenge[i] = tm;
+	}
+}
+
+// HMACs the challenge with the key's algorithm, returning the hash length
+static int hashChallenge(const OtpKey *otp_key, const uint8_t challenge[8], uint8_t hash[SHA512_DIGEST_LENGTH]) {
+	switch (otp_key->algorithm) {
+		case OTP_ALGORITHM_SHA256:
+			hmac_sha256_with_key(&otp_key->hmac.sha256, challenge, 8, hash, SHA256_DIGEST_LENGTH);
+			return SHA256_DIGEST_LENGTH;
+		case OTP_ALGORITHM_SHA512:
+			hmac_sha512(otp_key->secret, otp_key->secret_length, challenge, 8, hash, SHA512_DIGEST_LENGTH);
+			return SHA512_DIGEST_LENGTH;
+		default:
+			hmac_sha1_with_key(&otp_key->hmac.sha1, challenge, 8, hash, SHA1_DIGEST_LENGTH);
+			return SHA1_DIGEST_LENGTH;
+	}
+}
+
+static void truncateHash(const uint8_t *hash, int hashLength, int digits, char *tokenText) {
 	// Pick the offset where to sample our hash value for the actual verification
 	// code.
-	int offset = hash[SHA1_DIGEST_LENGTH - 1] & 0xF;
+	int offset = hash[hashLength - 1] & 0xF;
 	
 	// Compute the truncated hash in a byte-order independent loop.
 	unsigned int truncatedHash = 0;
@@ -72,19 +143,60 @@ char *generateCode(const char *key, int timezone_offset) {
 		truncatedHash  |= hash[offset + i];
 	}
 	
-	// Truncate to a smaller number of digits.
+	// Truncate to a smaller number of digits. Ten digits hold any 31 bit
+	// value, so only fewer need the modulus.
 	truncatedHash &= 0x7FFFFFFF;
-	truncatedHash %= VERIFICATION_CODE_MODULUS;
+	if (digits < 10) {
+		unsigned int modulus = 1;
+		for (int i = 0; i < digits; i++)
+			modulus *= 10;
+		truncatedHash %= modulus;
+	}
 
 	// Convert the truncatedHash int to a Char/String
-	static char tokenText[7] = "000000";
-
-	for(int i = 5; i >= 0; i--)
+	for(int i = digits-1; i >= 0; i--)
 	{
 		tokenText[i] = '0' + (truncatedHash % 10);
 		truncatedHash /= 10;
 	}
-	tokenText[6] = '\0';
+	tokenText[digits] = '\0';
+}
 
-	return tokenText;
+// Writes the code for the time step containing timestamp into tokenText.
+// Nothing is shared between calls, so codes for several keys or steps can be
+// computed back to back.
+int generateCodeAt(const OtpKey *otp_key, time_t timestamp, char *tokenText, int bufSize) {
+	if (otp_key->secret_length == 0) {
+		return OTP_INVALID_KEY;
+	}
+
+	if (bufSize < otp_key->digits + 1) {
+		return OTP_BUFFER_TOO_SMALL;
+	}
+
+	uint8_t challenge[8];
+	encodeChallenge(getKeyStep(otp_key, timestamp), challenge);
+
+	// Compute the HMAC of the secret and the challenge.
+	uint8_t hash[SHA512_DIGEST_LENGTH];
+	int hashLength = hashChallenge(otp_key, challenge, hash);
+
+	truncateHash(hash, hashLength, otp_key->digits, tokenText);
+	memset(hash, 0, sizeof(hash));
+	return OTP_OK;
+}
+
+// Fills tokenTexts with the codes of count keys at timestamp, one
+// generateCodeAt() call each. Keys that are not valid get an empty string.
+// Returns the number of codes made.
+int generate_codes_batch(const OtpKey *otp_keys, int count, time_t timestamp, char tokenTexts[][VERIFICATION_CODE_LENGTH]) {
+	int generated = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (generateCodeAt(&otp_keys[i], timestamp, tokenTexts[i], VERIFICATION_CODE_LENGTH) == OTP_OK)
+			generated++;
+		else
+			tokenTexts[i][0] = '\0';
+	}
+	return generated;
 }
\ No newline at end of file
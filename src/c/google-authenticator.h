@@ -23,9 +23,64 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "hmac.h"
 
-#define VERIFICATION_CODE_MODULUS (1000*1000) // Six digits
+#define VERIFICATION_CODE_LENGTH  11          // Up to 10 digits + termination
+#define TIME_STEP_SECONDS         30
 #define BITS_PER_BASE32_CHAR      5           // Base32 expands space by 8/5
+
+// Per key options from RFC 6238, stored in each key record
+#define OTP_ALGORITHM_SHA1   0
+#define OTP_ALGORITHM_SHA256 1
+#define OTP_ALGORITHM_SHA512 2
+#define OTP_DEFAULT_DIGITS   6
+#define OTP_MIN_DIGITS       6
+#define OTP_MAX_DIGITS       10
+#define OTP_DEFAULT_PERIOD   TIME_STEP_SECONDS
+
+// Result of generateCodeAt()
+enum {
+	OTP_OK = 0,
+	OTP_INVALID_KEY = -1,
+	OTP_BUFFER_TOO_SMALL = -2
+};
 	
-char *generateCode(const char *key, int timezone_offset)
+#define MAX_SECRET_LENGTH         80          // Decoded 128 character key
+
+// A stored secret prepared for code generation. The base32 text is decoded
+// and the HMAC key pads are hashed once, when the key is loaded. A
+// secret_length of zero marks a key that could not be decoded.
+//
+// This is 148 bytes, 80 for the secret and 64 for the midstates, which is
+// more than the 129 byte base32 text it replaced. Only the KEY_PAGE_SLOTS
+// pages of the key store are held in RAM, see key_store.h.
+typedef struct {
+	uint8_t secret[MAX_SECRET_LENGTH];
+	uint8_t secret_length;
+	uint8_t algorithm;
+	uint8_t digits;
+	uint8_t period; // seconds
+	union {
+		HMAC_SHA1_KEY sha1;
+		HMAC_SHA256_KEY sha256;
+	} hmac; // Unused by SHA512 keys
+} OtpKey;
+
+bool prepareKey(const char *key, OtpKey *otp_key)
+	__attribute__((visibility("hidden")));
+bool validSecret(int secretLen, int algorithm, int digits, int period)
+	__attribute__((visibility("hidden")));
+bool prepareSecret(const uint8_t *secret, int secretLen, int algorithm, int digits, int period, OtpKey *otp_key)
+	__attribute__((visibility("hidden")));
+long getKeyStep(const OtpKey *otp_key, time_t timestamp)
+	__attribute__((visibility("hidden")));
+bool sameSecret(const OtpKey *a, const OtpKey *b)
+	__attribute__((visibility("hidden")));
+time_t getOtpTime(int timezone_offset)
+	__attribute__((visibility("hidden")));
+int generateCodeAt(const OtpKey *otp_key, time_t timestamp, char *tokenText, int bufSize)
+	__attribute__((visibility("hidden")));
+int generate_codes_batch(const OtpKey *otp_keys, int count, time_t timestamp, char tokenTexts[][VERIFICATION_CODE_LENGTH])
 	__attribute__((visibility("hidden")));
\ No newline at end of file
@@ -1,4 +1,6 @@
-// HMAC_SHA1 implementation
+// HMAC-SHA1, HMAC-SHA256 and HMAC-SHA512 implementation. SHA1 and SHA256 keys
+// can have their padded key blocks hashed once and the midstates kept, so
+// each code only hashes the challenge. SHA512 keys are hashed in full.
 //
 // Copyright 2010 Google Inc.
 // Author: Markus Gutschke
@@ -19,15 +21,40 @@
 
 #include "hmac.h"
 #include "sha1.h"
+#include "sha2.h"
 
-void hmac_sha1(const uint8_t *key, int keyLength,
-               const uint8_t *data, int dataLength,
-               uint8_t *result, int resultLength) {
+// Hash one 64 byte padded key block and keep the resulting chaining value.
+static void hmac_sha1_midstate(const uint8_t *key, int keyLength, uint8_t pad,
+                               uint32_t midstate[5]) {
   SHA1_INFO ctx;
+  uint8_t tmp_key[SHA1_BLOCKSIZE];
+  for (int i = 0; i < keyLength; ++i) {
+    tmp_key[i] = key[i] ^ pad;
+  }
+  memset(tmp_key + keyLength, pad, SHA1_BLOCKSIZE - keyLength);
+
+  sha1_init(&ctx);
+  sha1_update(&ctx, tmp_key, SHA1_BLOCKSIZE);
+  memcpy(midstate, ctx.digest, 5 * sizeof(uint32_t));
+
+  memset(tmp_key, 0, sizeof(tmp_key));
+  memset(&ctx, 0, sizeof(ctx));
+}
+
+// Continue a digest from a chaining value captured after one full block.
+static void hmac_sha1_resume(SHA1_INFO *ctx, const uint32_t midstate[5]) {
+  sha1_init(ctx);
+  memcpy(ctx->digest, midstate, 5 * sizeof(uint32_t));
+  ctx->count_lo = SHA1_BLOCKSIZE << 3;
+}
+
+void hmac_sha1_init_key(HMAC_SHA1_KEY *hmac_key,
+                        const uint8_t *key, int keyLength) {
   uint8_t hashed_key[SHA1_DIGEST_LENGTH];
-  if (keyLength > 64) {
+  if (keyLength > SHA1_BLOCKSIZE) {
     // The key can be no bigger than 64 bytes. If it is, we'll hash it down to
     // 20 bytes.
+    SHA1_INFO ctx;
     sha1_init(&ctx);
     sha1_update(&ctx, key, keyLength);
     sha1_final(&ctx, hashed_key);
@@ -37,29 +64,28 @@ void hmac_sha1(const uint8_t *key, int keyLength,
 
   // The key for the inner digest is derived from our key, by padding the key
   // the full length of 64 bytes, and then XOR'ing each byte with 0x36.
-  uint8_t tmp_key[64];
-  for (int i = 0; i < keyLength; ++i) {
-    tmp_key[i] = key[i] ^ 0x36;
-  }
-  memset(tmp_key + keyLength, 0x36, 64 - keyLength);
+  hmac_sha1_midstate(key, keyLength, 0x36, hmac_key->inner);
+
+  // The key for the outer digest is derived from our key, by padding the key
+  // the full length of 64 bytes, and then XOR'ing each byte with 0x5C.
+  hmac_sha1_midstate(key, keyLength, 0x5C, hmac_key->outer);
+
+  memset(hashed_key, 0, sizeof(hashed_key));
+}
+
+void hmac_sha1_with_key(const HMAC_SHA1_KEY *hmac_key,
+                        const uint8_t *data, int dataLength,
+                        uint8_t *result, int resultLength) {
+  SHA1_INFO ctx;
+  uint8_t sha[SHA1_DIGEST_LENGTH];
 
   // Compute inner digest
-  sha1_init(&ctx);
-  sha1_update(&ctx, tmp_key, 64);
+  hmac_sha1_resume(&ctx, hmac_key->inner);
   sha1_update(&ctx, data, dataLength);
-  uint8_t sha[SHA1_DIGEST_LENGTH];
   sha1_final(&ctx, sha);
 
-  // The key for the outer digest is derived from our key, by padding the key
-  // the full length of 64 bytes, and then XOR'ing each byte with 0x5C.
-  for (int i = 0; i < keyLength; ++i) {
-    tmp_key[i] = key[i] ^ 0x5C;
-  }
-  memset(tmp_key + keyLength, 0x5C, 64 - keyLength);
-
   // Compute outer digest
-  sha1_init(&ctx);
-  sha1_update(&ctx, tmp_key, 64);
+  hmac_sha1_resume(&ctx, hmac_key->outer);
   sha1_update(&ctx, sha, SHA1_DIGEST_LENGTH);
   sha1_final(&ctx, sha);
 
@@ -71,7 +97,130 @@ void hmac_sha1(const uint8_t *key, int keyLength,
   memcpy(result, sha, resultLength);
 
   // Zero out all internal data structures
-  memset(hashed_key, 0, sizeof(hashed_key));
   memset(sha, 0, sizeof(sha));
+  memset(&ctx, 0, sizeof(ctx));
+}
+
+void hmac_sha1(const uint8_t *key, int keyLength,
+               const uint8_t *data, int dataLength,
+               uint8_t *result, int resultLength) {
+  HMAC_SHA1_KEY hmac_key;
+  hmac_sha1_init_key(&hmac_key, key, keyLength);
+  hmac_sha1_with_key(&hmac_key, data, dataLength, result, resultLength);
+  memset(&hmac_key, 0, sizeof(hmac_key));
+}
+
+// Copies as much of a digest as the caller asked for, zero padding the rest.
+static void hmac_copy_result(const uint8_t *digest, int digestLength,
+                             uint8_t *result, int resultLength) {
+  memset(result, 0, resultLength);
+  if (resultLength > digestLength) {
+    resultLength = digestLength;
+  }
+  memcpy(result, digest, resultLength);
+}
+
+static void hmac_sha256_midstate(const uint8_t *key, int keyLength, uint8_t pad,
+                                 uint32_t midstate[8]) {
+  SHA256_INFO ctx;
+  uint8_t tmp_key[SHA256_BLOCKSIZE];
+  for (int i = 0; i < keyLength; ++i) {
+    tmp_key[i] = key[i] ^ pad;
+  }
+  memset(tmp_key + keyLength, pad, SHA256_BLOCKSIZE - keyLength);
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, tmp_key, SHA256_BLOCKSIZE);
+  memcpy(midstate, ctx.state, 8 * sizeof(uint32_t));
+
   memset(tmp_key, 0, sizeof(tmp_key));
+  memset(&ctx, 0, sizeof(ctx));
+}
+
+static void hmac_sha256_resume(SHA256_INFO *ctx, const uint32_t midstate[8]) {
+  sha256_init(ctx);
+  memcpy(ctx->state, midstate, 8 * sizeof(uint32_t));
+  ctx->count = SHA256_BLOCKSIZE;
+}
+
+void hmac_sha256_init_key(HMAC_SHA256_KEY *hmac_key,
+                          const uint8_t *key, int keyLength) {
+  uint8_t hashed_key[SHA256_DIGEST_LENGTH];
+  if (keyLength > SHA256_BLOCKSIZE) {
+    SHA256_INFO ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, key, keyLength);
+    sha256_final(&ctx, hashed_key);
+    memset(&ctx, 0, sizeof(ctx));
+    key = hashed_key;
+    keyLength = SHA256_DIGEST_LENGTH;
+  }
+
+  hmac_sha256_midstate(key, keyLength, 0x36, hmac_key->inner);
+  hmac_sha256_midstate(key, keyLength, 0x5C, hmac_key->outer);
+
+  memset(hashed_key, 0, sizeof(hashed_key));
+}
+
+void hmac_sha256_with_key(const HMAC_SHA256_KEY *hmac_key,
+                          const uint8_t *data, int dataLength,
+                          uint8_t *result, int resultLength) {
+  SHA256_INFO ctx;
+  uint8_t sha[SHA256_DIGEST_LENGTH];
+
+  hmac_sha256_resume(&ctx, hmac_key->inner);
+  sha256_update(&ctx, data, dataLength);
+  sha256_final(&ctx, sha);
+
+  hmac_sha256_resume(&ctx, hmac_key->outer);
+  sha256_update(&ctx, sha, SHA256_DIGEST_LENGTH);
+  sha256_final(&ctx, sha);
+
+  hmac_copy_result(sha, SHA256_DIGEST_LENGTH, result, resultLength);
+
+  memset(sha, 0, sizeof(sha));
+  memset(&ctx, 0, sizeof(ctx));
 }
+
+// Hashes both key pads every time, see HMAC_SHA256_KEY
+void hmac_sha512(const uint8_t *key, int keyLength,
+                 const uint8_t *data, int dataLength,
+                 uint8_t *result, int resultLength) {
+  SHA512_INFO ctx;
+  uint8_t tmp_key[SHA512_BLOCKSIZE];
+  uint8_t sha[SHA512_DIGEST_LENGTH];
+
+  if (keyLength > SHA512_BLOCKSIZE) {
+    sha512_init(&ctx);
+    sha512_update(&ctx, key, keyLength);
+    sha512_final(&ctx, sha);
+    key = sha;
+    keyLength = SHA512_DIGEST_LENGTH;
+  }
+  memset(tmp_key, 0, sizeof(tmp_key));
+  memcpy(tmp_key, key, keyLength);
+
+  // Compute inner digest
+  for (int i = 0; i < SHA512_BLOCKSIZE; ++i) {
+    tmp_key[i] ^= 0x36;
+  }
+  sha512_init(&ctx);
+  sha512_update(&ctx, tmp_key, SHA512_BLOCKSIZE);
+  sha512_update(&ctx, data, dataLength);
+  sha512_final(&ctx, sha);
+
+  // Compute outer digest, turning the inner pad into the outer one
+  for (int i = 0; i < SHA512_BLOCKSIZE; ++i) {
+    tmp_key[i] ^= 0x36 ^ 0x5C;
+  }
+  sha512_init(&ctx);
+  sha512_update(&ctx, tmp_key, SHA512_BLOCKSIZE);
+  sha512_update(&ctx, sha, SHA512_DIGEST_LENGTH);
+  sha512_final(&ctx, sha);
+
+  hmac_copy_result(sha, SHA512_DIGEST_LENGTH, result, resultLength);
+
+  memset(tmp_key, 0, sizeof(tmp_key));
+  memset(sha, 0, sizeof(sha));
+  memset(&ctx, 0, sizeof(ctx));
+}
\ No newline at end of file
@@ -18,7 +18,40 @@
 #pragma once
 #include <stdint.h>
 
+// Precomputed state for a fixed HMAC_SHA1 key. Holds the SHA1 chaining values
+// after the 64 byte inner (ipad) and outer (opad) key blocks have been hashed,
+// so that each subsequent HMAC only needs to hash the message itself.
+typedef struct {
+  uint32_t inner[5];
+  uint32_t outer[5];
+} HMAC_SHA1_KEY;
+
+// The same for HMAC_SHA256. SHA512 keys have no precomputed form, their
+// chaining values would double the size of every key for a rare algorithm.
+typedef struct {
+  uint32_t inner[8];
+  uint32_t outer[8];
+} HMAC_SHA256_KEY;
+
+void hmac_sha1_init_key(HMAC_SHA1_KEY *hmac_key,
+                        const uint8_t *key, int keyLength)
+ __attribute__((visibility("hidden")));
+void hmac_sha1_with_key(const HMAC_SHA1_KEY *hmac_key,
+                        const uint8_t *data, int dataLength,
+                        uint8_t *result, int resultLength)
+ __attribute__((visibility("hidden")));
 void hmac_sha1(const uint8_t *key, int keyLength,
                const uint8_t *data, int dataLength,
                uint8_t *result, int resultLength)
+ __attribute__((visibility("hidden")));
+void hmac_sha256_init_key(HMAC_SHA256_KEY *hmac_key,
+                          const uint8_t *key, int keyLength)
+ __attribute__((visibility("hidden")));
+void hmac_sha256_with_key(const HMAC_SHA256_KEY *hmac_key,
+                          const uint8_t *data, int dataLength,
+                          uint8_t *result, int resultLength)
+ __attribute__((visibility("hidden")));
+void hmac_sha512(const uint8_t *key, int keyLength,
+                 const uint8_t *data, int dataLength,
+                 uint8_t *result, int resultLength)
  __attribute__((visibility("hidden")));
\ No newline at end of file
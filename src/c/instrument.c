@@ -0,0 +1,97 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#include "pebble.h"
+#include "instrument.h"
+
+#if INSTRUMENT
+
+typedef struct {
+	uint32_t started;
+	uint16_t duration;
+	uint8_t probe;
+} InstrumentEvent;
+
+typedef struct {
+	uint16_t count;
+	uint16_t max;
+	uint32_t total;
+	uint16_t buckets[INSTRUMENT_BUCKETS];
+} ProbeStats;
+
+static const char *probe_names[PROBE_COUNT] = {
+	"init",
+	"load",
+	"fonts",
+	"frame",
+	"code",
+	"code batch",
+	"code prefetch",
+	"persist read",
+	"persist write"
+};
+
+static InstrumentEvent events[INSTRUMENT_EVENTS];
+static unsigned int next_event;
+static ProbeStats stats[PROBE_COUNT];
+
+uint32_t instrument_now(void) {
+	time_t seconds;
+	uint16_t milliseconds;
+	time_ms(&seconds, &milliseconds);
+	return (uint32_t)seconds * 1000 + milliseconds;
+}
+
+void instrument_record(Probe probe, uint32_t started) {
+	uint32_t duration = instrument_now() - started;
+	if (duration > UINT16_MAX)
+		duration = UINT16_MAX;
+
+	InstrumentEvent *event = &events[next_event++ % INSTRUMENT_EVENTS];
+	event->started = started;
+	event->duration = duration;
+	event->probe = probe;
+
+	// Bucket 0 is 0ms, bucket n holds 2^(n-1) to 2^n - 1 ms
+	int bucket = 0;
+	while (bucket < INSTRUMENT_BUCKETS-1 && duration >> bucket)
+		bucket++;
+
+	ProbeStats *probe_stats = &stats[probe];
+	probe_stats->count++;
+	probe_stats->total += duration;
+	if (duration > probe_stats->max)
+		probe_stats->max = duration;
+	probe_stats->buckets[bucket]++;
+}
+
+void instrument_dump(void) {
+	for (int p = 0; p < PROBE_COUNT; p++) {
+		ProbeStats *probe_stats = &stats[p];
+		if (probe_stats->count == 0)
+			continue;
+
+		char histogram[INSTRUMENT_BUCKETS * 6 + 1];
+		int length = 0;
+		for (int b = 0; b < INSTRUMENT_BUCKETS; b++)
+			length += snprintf(histogram + length, sizeof(histogram) - length, " %d", probe_stats->buckets[b]);
+
+		APP_LOG(APP_LOG_LEVEL_INFO, "PERF %s: n=%d avg=%dms max=%dms |%s",
+			probe_names[p], probe_stats->count, (int)(probe_stats->total / probe_stats->count),
+			probe_stats->max, histogram);
+	}
+
+	unsigned int first = next_event > INSTRUMENT_EVENTS ? next_event - INSTRUMENT_EVENTS : 0;
+	for (unsigned int i = first; i < next_event; i++) {
+		InstrumentEvent *event = &events[i % INSTRUMENT_EVENTS];
+		APP_LOG(APP_LOG_LEVEL_INFO, "PERF @%d %s %dms",
+			(int)(event->started - events[first % INSTRUMENT_EVENTS].started),
+			probe_names[event->probe], event->duration);
+	}
+}
+
+#endif
@@ -0,0 +1,48 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+#include "pebble.h"
+
+#define DEBUG false
+
+// Set to true to time the probes below. When false every INSTRUMENT_ macro
+// compiles to nothing and instrument.c adds no code or RAM.
+#define INSTRUMENT false
+
+#define DEBUG_LOG(...) \
+do { if (DEBUG) APP_LOG(APP_LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+typedef enum {
+	PROBE_INIT,
+	PROBE_LOAD,
+	PROBE_FONTS,
+	PROBE_FRAME,
+	PROBE_CODE,
+	PROBE_CODE_BATCH,
+	PROBE_CODE_PREFETCH,
+	PROBE_PERSIST_READ,
+	PROBE_PERSIST_WRITE,
+	PROBE_COUNT
+} Probe;
+
+#define INSTRUMENT_EVENTS 32 // Most recent timings kept in the ring buffer
+#define INSTRUMENT_BUCKETS 10 // Histogram buckets, 0ms, 1ms, 2-3ms ... 256ms+
+
+#if INSTRUMENT
+#define INSTRUMENT_BEGIN(probe) uint32_t probe##_started = instrument_now()
+#define INSTRUMENT_END(probe) instrument_record(probe, probe##_started)
+#define INSTRUMENT_DUMP() instrument_dump()
+#else
+#define INSTRUMENT_BEGIN(probe)
+#define INSTRUMENT_END(probe)
+#define INSTRUMENT_DUMP()
+#endif
+
+uint32_t instrument_now(void);
+void instrument_record(Probe probe, uint32_t started);
+void instrument_dump(void);
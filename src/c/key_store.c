@@ -0,0 +1,638 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#include "pebble.h"
+#include "main.h"
+#include "key_store.h"
+
+#define NO_RECORD 0xFF
+
+// What is kept in RAM for every key besides its label, packed to save the
+// padding on each of MAX_OTP keys
+typedef struct __attribute__((packed)) {
+	uint32_t digest; // See key_store_record_digest()
+	uint32_t fingerprint; // Digest of the secret alone, see key_store_find()
+	uint8_t period;
+} KeyInfo;
+
+static KeyStoreHeader store_header;
+static uint8_t key_records[MAX_OTP]; // Record number of each key, in display order
+static KeyInfo key_info[MAX_OTP]; // In display order
+static uint8_t key_ids[MAX_KEY_RECORDS]; // Display position of each record
+static uint8_t block_records[MAX_KEY_BLOCKS]; // Number of records in each block
+static uint8_t key_index[KEY_INDEX_SLOTS]; // key_id+1 by fingerprint, 0 when empty
+
+// Secrets of the pages in RAM
+static OtpKey page_keys[KEY_PAGE_SLOTS][KEY_PAGE_SIZE];
+static uint8_t page_numbers[KEY_PAGE_SLOTS]; // KEY_NO_PAGE when empty
+static unsigned int page_used[KEY_PAGE_SLOTS];
+static unsigned int page_clock;
+static const OtpKey no_key;
+
+// Background loading state
+static bool key_loaded[MAX_OTP];
+static unsigned int load_key_count;
+static unsigned int load_block_id;
+static unsigned int load_record;
+static unsigned int preloaded_block;
+static bool loading;
+
+static int read_data(uint32_t key, void *buffer, size_t size) {
+	INSTRUMENT_BEGIN(PROBE_PERSIST_READ);
+	int result = persist_read_data(key, buffer, size);
+	INSTRUMENT_END(PROBE_PERSIST_READ);
+	return result;
+}
+
+static int write_data(uint32_t key, const void *buffer, size_t size) {
+	INSTRUMENT_BEGIN(PROBE_PERSIST_WRITE);
+	int result = persist_write_data(key, buffer, size);
+	INSTRUMENT_END(PROBE_PERSIST_WRITE);
+	return result;
+}
+
+// FNV-1a over the label, a zero byte, the binary secret and the algorithm,
+// digits and period bytes of a packed record. The phone works out the same
+// digest from its "label:key" text.
+uint32_t key_store_record_digest(const uint8_t *record) {
+	const uint8_t *label = record + KEY_RECORD_HEADER_LENGTH;
+	const uint8_t *secret = label + record[0];
+	uint32_t digest = KEY_DIGEST_BASIS;
+
+	for (int i = 0; i < record[0]; i++)
+		digest = (digest ^ label[i]) * KEY_DIGEST_PRIME;
+	digest *= KEY_DIGEST_PRIME;
+	for (int i = 0; i < record[1]; i++)
+		digest = (digest ^ secret[i]) * KEY_DIGEST_PRIME;
+	for (int i = 2; i < KEY_RECORD_HEADER_LENGTH; i++)
+		digest = (digest ^ record[i]) * KEY_DIGEST_PRIME;
+
+	return digest;
+}
+
+// FNV-1a over the binary secret alone, so a key is found again whatever its
+// label or options
+static uint32_t secret_fingerprint(const uint8_t *secret, int length) {
+	uint32_t digest = KEY_DIGEST_BASIS;
+	for (int i = 0; i < length; i++)
+		digest = (digest ^ secret[i]) * KEY_DIGEST_PRIME;
+	return digest;
+}
+
+static void index_key(unsigned int key_id) {
+	unsigned int slot = key_info[key_id].fingerprint & (KEY_INDEX_SLOTS-1);
+	while (key_index[slot])
+		slot = (slot+1) & (KEY_INDEX_SLOTS-1);
+	key_index[slot] = key_id+1;
+}
+
+// Moving or deleting a key renumbers the ones after it, so the index is
+// simply built again
+static void index_keys(void) {
+	memset(key_index, 0, sizeof(key_index));
+	for (unsigned int key_id = 0; key_id < watch_otp_count; key_id++)
+		index_key(key_id);
+}
+
+static void map_records(void) {
+	memset(key_ids, NO_RECORD, sizeof(key_ids));
+	for (unsigned int key_id = 0; key_id < watch_otp_count; key_id++) {
+		if (key_records[key_id] < MAX_KEY_RECORDS)
+			key_ids[key_records[key_id]] = key_id;
+	}
+}
+
+static void drop_pages(void) {
+	memset(page_keys, 0, sizeof(page_keys));
+	memset(page_numbers, KEY_NO_PAGE, sizeof(page_numbers));
+}
+
+static int page_slot(unsigned int page) {
+	for (int slot = 0; slot < KEY_PAGE_SLOTS; slot++) {
+		if (page_numbers[slot] == page)
+			return slot;
+	}
+	return -1;
+}
+
+static int pack_record(const char *label, const OtpKey *key, uint8_t *buffer, int size) {
+	int label_length = strlen(label);
+	int length = KEY_RECORD_HEADER_LENGTH + label_length + key->secret_length;
+
+	if (length > size)
+		return -1;
+
+	buffer[0] = label_length;
+	buffer[1] = key->secret_length;
+	buffer[2] = key->algorithm;
+	buffer[3] = key->digits;
+	buffer[4] = key->period;
+	memcpy(buffer + KEY_RECORD_HEADER_LENGTH, label, label_length);
+	memcpy(buffer + KEY_RECORD_HEADER_LENGTH + label_length, key->secret, key->secret_length);
+	return length;
+}
+
+static int record_length(const uint8_t *buffer, int size) {
+	if (size < KEY_RECORD_HEADER_LENGTH)
+		return -1;
+
+	int length = KEY_RECORD_HEADER_LENGTH + buffer[0] + buffer[1];
+	if (buffer[0] >= MAX_LABEL_LENGTH || buffer[1] > MAX_SECRET_LENGTH || length > size)
+		return -1;
+
+	return length;
+}
+
+// Everything but the secret, which only goes into a page
+static bool unpack_info(const uint8_t *buffer, unsigned int key_id) {
+	if (!validSecret(buffer[1], buffer[2], buffer[3], buffer[4]))
+		return false;
+
+	memcpy(otp_labels[key_id], buffer + KEY_RECORD_HEADER_LENGTH, buffer[0]);
+	otp_labels[key_id][buffer[0]] = '\0';
+	key_info[key_id].digest = key_store_record_digest(buffer);
+	key_info[key_id].fingerprint = secret_fingerprint(buffer + KEY_RECORD_HEADER_LENGTH + buffer[0], buffer[1]);
+	key_info[key_id].period = buffer[4];
+	return true;
+}
+
+bool key_store_read_record(const uint8_t *record, int length, char *label, OtpKey *key) {
+	if (record_length(record, length) < 0) {
+		key->secret_length = 0;
+		return false;
+	}
+
+	memcpy(label, record + KEY_RECORD_HEADER_LENGTH, record[0]);
+	label[record[0]] = '\0';
+	return prepareSecret(record + KEY_RECORD_HEADER_LENGTH + record[0], record[1], record[2], record[3], record[4], key);
+}
+
+static bool write_header(void) {
+	store_header.version = KEY_STORE_VERSION;
+	return write_data(PS_KEY_STORE, &store_header, sizeof(store_header)) >= 0;
+}
+
+static bool write_order(void) {
+	if (watch_otp_count == 0) {
+		persist_delete(PS_KEY_ORDER);
+		return true;
+	}
+	return write_data(PS_KEY_ORDER, key_records, watch_otp_count) >= 0;
+}
+
+static bool save_failed(void) {
+	APP_LOG(APP_LOG_LEVEL_ERROR, "ERROR: Unable to save keys");
+	return false;
+}
+
+// Reads block b, whose first record is number record. Labels and digests are
+// unpacked while loading, secrets only for keys on the pages in RAM. Returns
+// false if the block could not be read.
+static bool load_block(unsigned int b, unsigned int record, bool load_info) {
+	uint8_t block[KEY_BLOCK_SIZE];
+	int size = read_data(PS_KEY_BLOCK+b, block, sizeof(block));
+	if (size < 1)
+		return false;
+
+	int offset = 1;
+	for (int r = 0; r < block[0]; r++, record++) {
+		const uint8_t *data = block + offset;
+		int length = record_length(data, size - offset);
+		if (length < 0) {
+			DEBUG_LOG("INFO: Bad key record in block %d", b);
+			break;
+		}
+		offset += length;
+
+		unsigned int key_id = record < MAX_KEY_RECORDS ? key_ids[record] : NO_RECORD;
+		if (key_id == NO_RECORD)
+			continue;
+		if (load_info)
+			key_loaded[key_id] = unpack_info(data, key_id);
+
+		int slot = page_slot(key_id / KEY_PAGE_SIZE);
+		if (slot >= 0)
+			prepareSecret(data + KEY_RECORD_HEADER_LENGTH + data[0], data[1], data[2], data[3], data[4], &page_keys[slot][key_id % KEY_PAGE_SIZE]);
+	}
+
+	memset(block, 0, sizeof(block));
+	return true;
+}
+
+// Closes any gaps left by keys whose records could not be read. Returns true
+// if there were any.
+static bool drop_missing_keys(unsigned int key_count) {
+	watch_otp_count = 0;
+	for (unsigned int i = 0; i < key_count; i++) {
+		if (!key_loaded[i])
+			continue;
+		if (watch_otp_count != i) {
+			strcpy(otp_labels[watch_otp_count], otp_labels[i]);
+			key_records[watch_otp_count] = key_records[i];
+			key_info[watch_otp_count] = key_info[i];
+		}
+		watch_otp_count++;
+	}
+
+	if (watch_otp_count == key_count)
+		return false;
+
+	DEBUG_LOG("INFO: Kept %d of %d keys", watch_otp_count, key_count);
+	map_records();
+	drop_pages();
+	return true;
+}
+
+static void finish_load(void) {
+	loading = false;
+
+	if (drop_missing_keys(load_key_count))
+		write_order();
+	index_keys();
+}
+
+// Sets up the key table and loads only the block holding first_key, with the
+// secrets of its page. The rest are read one block at a time by
+// key_store_load_next().
+bool key_store_load(unsigned int first_key) {
+	memset(key_ids, NO_RECORD, sizeof(key_ids));
+	memset(block_records, 0, sizeof(block_records));
+	drop_pages();
+
+	if (read_data(PS_KEY_STORE, &store_header, sizeof(store_header)) != sizeof(store_header) ||
+	    store_header.version != KEY_STORE_VERSION) {
+		memset(&store_header, 0, sizeof(store_header));
+		return false;
+	}
+	if (store_header.block_count > MAX_KEY_BLOCKS)
+		store_header.block_count = MAX_KEY_BLOCKS;
+
+	// Without an order record the keys are shown in the order they were saved
+	int key_count = read_data(PS_KEY_ORDER, key_records, sizeof(key_records));
+	if (key_count < 0) {
+		key_count = store_header.record_count < MAX_OTP ? store_header.record_count : MAX_OTP;
+		for (int i = 0; i < key_count; i++)
+			key_records[i] = i;
+	}
+
+	watch_otp_count = key_count;
+	map_records();
+	memset(key_loaded, 0, sizeof(key_loaded));
+
+	load_key_count = key_count;
+	load_block_id = 0;
+	load_record = 0;
+	preloaded_block = NO_RECORD;
+	loading = true;
+
+	if (first_key >= (unsigned int)key_count)
+		first_key = 0;
+	page_numbers[0] = first_key / KEY_PAGE_SIZE;
+	page_used[0] = ++page_clock;
+
+	// Only the first byte of each block is needed to count its records. A
+	// block that cannot be read ends the store.
+	unsigned int record = 0;
+	for (unsigned int b = 0; b < store_header.block_count; b++) {
+		if (read_data(PS_KEY_BLOCK+b, &block_records[b], 1) != 1) {
+			store_header.block_count = b;
+			break;
+		}
+		if (key_count > 0 && preloaded_block == NO_RECORD && key_records[first_key] < record + block_records[b]) {
+			load_block(b, record, true);
+			preloaded_block = b;
+		}
+		record += block_records[b];
+	}
+
+	if (store_header.block_count == 0)
+		finish_load();
+
+	return true;
+}
+
+// Loads the next block not yet read. Returns true while there is more to load.
+bool key_store_load_next(void) {
+	if (!loading)
+		return false;
+
+	if (load_block_id < store_header.block_count) {
+		if (load_block_id != preloaded_block && !load_block(load_block_id, load_record, true)) {
+			load_block_id = store_header.block_count;
+		} else {
+			load_record += block_records[load_block_id];
+			load_block_id++;
+		}
+	}
+
+	if (load_block_id < store_header.block_count)
+		return true;
+
+	finish_load();
+	return false;
+}
+
+bool key_store_loading(void) {
+	return loading;
+}
+
+// Reads in the secrets of a page over the page used longest ago, reading only
+// the blocks that hold its records
+static int load_page(unsigned int page) {
+	int slot = page_slot(page);
+	if (slot < 0) {
+		slot = 0;
+		for (int s = 1; s < KEY_PAGE_SLOTS; s++) {
+			if (page_used[s] < page_used[slot])
+				slot = s;
+		}
+		memset(page_keys[slot], 0, sizeof(page_keys[slot]));
+		page_numbers[slot] = page;
+
+		unsigned int first = page * KEY_PAGE_SIZE;
+		unsigned int end = first + KEY_PAGE_SIZE < watch_otp_count ? first + KEY_PAGE_SIZE : watch_otp_count;
+		unsigned int record = 0;
+		for (unsigned int b = 0; b < store_header.block_count; b++) {
+			unsigned int key_id = first;
+			while (key_id < end && (key_records[key_id] < record || key_records[key_id] >= record + block_records[b]))
+				key_id++;
+			if (key_id < end)
+				load_block(b, record, false);
+			record += block_records[b];
+		}
+	}
+
+	page_used[slot] = ++page_clock;
+	return slot;
+}
+
+const OtpKey *key_store_page(unsigned int page, unsigned int *count) {
+	unsigned int first = page * KEY_PAGE_SIZE;
+	if (first >= watch_otp_count) {
+		*count = 0;
+		return &no_key;
+	}
+
+	*count = watch_otp_count - first < KEY_PAGE_SIZE ? watch_otp_count - first : KEY_PAGE_SIZE;
+	return page_keys[load_page(page)];
+}
+
+const OtpKey *key_store_key(unsigned int key_id) {
+	if (key_id >= watch_otp_count)
+		return &no_key;
+
+	unsigned int count;
+	return &key_store_page(key_id / KEY_PAGE_SIZE, &count)[key_id % KEY_PAGE_SIZE];
+}
+
+unsigned int key_store_period(unsigned int key_id) {
+	return key_id < watch_otp_count ? key_info[key_id].period : 0;
+}
+
+// Compacts the store, dropping records no key uses any more. Records keep
+// their order, so each block has been read before any output reaches it and
+// no secret has to be in RAM. Keys whose records cannot be read are lost.
+bool key_store_rewrite(void) {
+	uint8_t block[KEY_BLOCK_SIZE];
+	uint8_t output[KEY_BLOCK_SIZE];
+	bool result = true;
+	unsigned int record = 0;
+	unsigned int new_record = 0;
+	unsigned int b_out = 0;
+	int size_out = 1;
+	output[0] = 0;
+
+	// A key being added has no record yet
+	for (unsigned int key_id = 0; key_id < watch_otp_count; key_id++)
+		key_loaded[key_id] = key_records[key_id] == NO_RECORD;
+
+	for (unsigned int b = 0; b < store_header.block_count; b++) {
+		int size = read_data(PS_KEY_BLOCK+b, block, sizeof(block));
+		if (size < 1)
+			break;
+
+		int offset = 1;
+		for (int r = 0; r < block[0]; r++) {
+			int length = record_length(block + offset, size - offset);
+			if (length < 0)
+				break;
+
+			unsigned int key_id = record + r < MAX_KEY_RECORDS ? key_ids[record + r] : NO_RECORD;
+			if (key_id != NO_RECORD) {
+				if (size_out + length > KEY_BLOCK_SIZE) {
+					if (write_data(PS_KEY_BLOCK+b_out, output, size_out) < 0)
+						result = false;
+					block_records[b_out++] = output[0];
+					size_out = 1;
+					output[0] = 0;
+				}
+				memcpy(output + size_out, block + offset, length);
+				size_out += length;
+				output[0]++;
+				key_records[key_id] = new_record++;
+				key_loaded[key_id] = true;
+			}
+			offset += length;
+		}
+		record += block[0];
+	}
+
+	if (output[0] > 0) {
+		if (write_data(PS_KEY_BLOCK+b_out, output, size_out) < 0)
+			result = false;
+		block_records[b_out++] = output[0];
+	}
+	memset(block, 0, sizeof(block));
+	memset(output, 0, sizeof(output));
+
+	for (unsigned int b = b_out; b < store_header.block_count; b++)
+		persist_delete(PS_KEY_BLOCK+b);
+
+	store_header.record_count = new_record;
+	store_header.block_count = b_out;
+	if (drop_missing_keys(watch_otp_count))
+		index_keys();
+	else
+		map_records();
+
+	if (!write_header() || !write_order())
+		result = false;
+
+	return result ? true : save_failed();
+}
+
+// Adds a packed record after the last one, in a new block if it does not
+// fit. Returns its record number, or -1 if the store is full.
+static int append_record(const uint8_t *record, int length) {
+	uint8_t block[KEY_BLOCK_SIZE];
+	unsigned int b = store_header.block_count;
+	int size = 0;
+
+	if (store_header.record_count >= MAX_KEY_RECORDS)
+		return -1;
+
+	if (b > 0) {
+		size = read_data(PS_KEY_BLOCK+b-1, block, sizeof(block));
+		if (size >= 1 && size + length <= KEY_BLOCK_SIZE)
+			b--;
+		else
+			size = 0;
+	}
+
+	if (size == 0) {
+		if (b >= MAX_KEY_BLOCKS)
+			return -1;
+		size = 1;
+		block[0] = 0;
+	}
+	memcpy(block + size, record, length);
+	block[0]++;
+
+	int count = block[0];
+	bool result = write_data(PS_KEY_BLOCK+b, block, size + length) >= 0;
+	memset(block, 0, sizeof(block));
+	if (!result)
+		return -1;
+
+	block_records[b] = count;
+	store_header.block_count = b+1;
+	return store_header.record_count++;
+}
+
+// Records no key points at any more, which compacting would drop
+static bool has_unused_records(void) {
+	for (unsigned int record = 0; record < store_header.record_count && record < MAX_KEY_RECORDS; record++) {
+		if (key_ids[record] == NO_RECORD)
+			return true;
+	}
+	return false;
+}
+
+// Saves a new or relabelled key, labelled otp_labels[key_id]. Its record is
+// appended to the last block and the key pointed at it, any record it had
+// before is left unused. A full store is compacted and tried again if that
+// frees anything, so a store full of live keys fails without rewriting it.
+bool key_store_save_key(unsigned int key_id, const OtpKey *key) {
+	uint8_t record[MAX_KEY_RECORD_LENGTH];
+	int length = pack_record(otp_labels[key_id], key, record, sizeof(record));
+
+	if (key_records[key_id] >= MAX_KEY_RECORDS || key_ids[key_records[key_id]] != key_id)
+		key_records[key_id] = NO_RECORD;
+
+	int new_record = length < 0 ? -1 : append_record(record, length);
+	if (new_record < 0 && length >= 0 && has_unused_records()) {
+		key_store_rewrite();
+		if (key_id < watch_otp_count)
+			new_record = append_record(record, length);
+	}
+	if (new_record < 0) {
+		memset(record, 0, sizeof(record));
+		return save_failed();
+	}
+
+	if (key_records[key_id] != NO_RECORD)
+		key_ids[key_records[key_id]] = NO_RECORD;
+	key_records[key_id] = new_record;
+	key_ids[new_record] = key_id;
+
+	bool indexed = key_store_find(key) == (int)key_id;
+	unpack_info(record, key_id);
+	if (!indexed)
+		index_key(key_id);
+	memset(record, 0, sizeof(record));
+
+	int slot = page_slot(key_id / KEY_PAGE_SIZE);
+	if (slot >= 0)
+		page_keys[slot][key_id % KEY_PAGE_SIZE] = *key;
+
+	if (!write_header() || !write_order())
+		return save_failed();
+	return true;
+}
+
+// The pages in RAM no longer line up with their keys once these move, so
+// they are dropped and read in again when next needed
+bool key_store_move(unsigned int key_id, unsigned int new_position) {
+	char label_buffer[MAX_LABEL_LENGTH];
+	uint8_t record_buffer;
+	KeyInfo info_buffer;
+
+	strcpy(label_buffer, otp_labels[key_id]);
+	record_buffer = key_records[key_id];
+	info_buffer = key_info[key_id];
+
+	if (key_id > new_position) {
+		for (unsigned int i = key_id; i > new_position; i--) {
+			strcpy(otp_labels[i], otp_labels[i-1]);
+			key_records[i] = key_records[i-1];
+			key_info[i] = key_info[i-1];
+		}
+	} else if (new_position > key_id) {
+		for (unsigned int i = key_id; i < new_position; i++) {
+			strcpy(otp_labels[i], otp_labels[i+1]);
+			key_records[i] = key_records[i+1];
+			key_info[i] = key_info[i+1];
+		}
+	}
+
+	strcpy(otp_labels[new_position], label_buffer);
+	key_records[new_position] = record_buffer;
+	key_info[new_position] = info_buffer;
+
+	map_records();
+	drop_pages();
+	index_keys();
+
+	return write_order() ? true : save_failed();
+}
+
+bool key_store_delete(unsigned int key_id) {
+	for (unsigned int i = key_id; i+1 < watch_otp_count; i++) {
+		strcpy(otp_labels[i], otp_labels[i+1]);
+		key_records[i] = key_records[i+1];
+		key_info[i] = key_info[i+1];
+	}
+	watch_otp_count--;
+
+	map_records();
+	drop_pages();
+	index_keys();
+
+	// A missing order record means saved order, so an empty table has to
+	// drop its records as well
+	if (watch_otp_count == 0)
+		return key_store_rewrite();
+
+	return write_order() ? true : save_failed();
+}
+
+// Position of the key with the same secret, or -1 if there is none. Only
+// keys whose fingerprints match have their secrets read in and compared.
+int key_store_find(const OtpKey *key) {
+	if (key->secret_length == 0)
+		return -1;
+
+	uint32_t fingerprint = secret_fingerprint(key->secret, key->secret_length);
+	for (unsigned int slot = fingerprint & (KEY_INDEX_SLOTS-1); key_index[slot]; slot = (slot+1) & (KEY_INDEX_SLOTS-1)) {
+		unsigned int key_id = key_index[slot]-1;
+		if (key_info[key_id].fingerprint == fingerprint && sameSecret(key, key_store_key(key_id)))
+			return key_id;
+	}
+	return -1;
+}
+
+uint32_t key_store_digest(unsigned int key_id) {
+	return key_info[key_id].digest;
+}
+
+// Independent of order, so reordering keys on the watch does not cause a sync
+uint32_t key_store_table_digest(void) {
+	uint32_t digest = watch_otp_count;
+	for (unsigned int i = 0; i < watch_otp_count; i++)
+		digest += key_info[i].digest;
+	return digest;
+}
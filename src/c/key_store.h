@@ -0,0 +1,86 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+#include "pebble.h"
+
+#define KEY_STORE_VERSION 1
+#define KEY_BLOCK_SIZE PERSIST_DATA_MAX_LENGTH
+#define MAX_KEY_RECORDS (MAX_OTP+16) // Live and replaced records, compacted when full
+#define MAX_KEY_BLOCKS 15 // 3840 bytes, what is left of the 4KB an app may persist
+#define KEY_LOAD_INTERVAL 10 // Milliseconds between background block reads
+#define KEY_PAGE_SIZE 4 // Keys whose secrets are read in together
+#define KEY_PAGE_SLOTS 2 // Pages held in RAM, enough for every row on screen
+#define KEY_NO_PAGE 0xFF
+
+// Each key is saved as one packed record. Records are appended back to back
+// into as few KEY_BLOCK_SIZE persist blocks as they fit, each block starting
+// with a count of the records it holds. A record never spans two blocks.
+//
+//   label_length, secret_length, algorithm, digits, period,
+//   label (no termination), secret (binary)
+//
+// algorithm, digits and period are the key's OTP_ALGORITHM_*, code length
+// and time step in seconds, see google-authenticator.h.
+//
+// The display order is kept separately in PS_KEY_ORDER as one record number
+// per key. Reordering or deleting a key only rewrites that small order
+// record. Records no longer listed in it are dropped the next time the store
+// fills up and is compacted.
+//
+// A key with a 12 character label and the usual 16 character secret takes
+// 27 bytes, nine to a block, so MAX_OTP of them fit in MAX_KEY_BLOCKS. With
+// 32 character secrets about 90 fit. Once the store is full new keys are
+// refused. The 4KB an app may persist is what holds MAX_OTP at 100, more keys
+// could not be saved whatever RAM was spared for them.
+//
+// Only labels and a few bytes per key stay in RAM, about 36 bytes for each of
+// MAX_OTP. Secrets are read from the store a page of KEY_PAGE_SIZE keys at a
+// time when one of them is asked for, and at most KEY_PAGE_SLOTS pages are
+// held, replacing the one used longest ago. Those take about 1.2KB however
+// many keys there are.
+#define KEY_RECORD_HEADER_LENGTH 5
+#define MAX_KEY_RECORD_LENGTH (KEY_RECORD_HEADER_LENGTH + MAX_LABEL_LENGTH-1 + MAX_SECRET_LENGTH)
+
+#define KEY_DIGEST_BASIS 2166136261u
+#define KEY_DIGEST_PRIME 16777619u
+
+// Keys are also indexed by a fingerprint of their binary secret, an open
+// addressed table with this many slots. A power of two at least twice
+// MAX_OTP keeps the probe runs short.
+#define KEY_INDEX_SLOTS 256
+
+typedef struct {
+	uint8_t version;
+	uint8_t record_count;
+	uint8_t block_count;
+} KeyStoreHeader;
+
+// Loading is split so the first code can be shown straight away.
+// key_store_load() fills in the key count and the block holding first_key,
+// key_store_load_next() then reads the remaining blocks one per call. Keys
+// not yet read have an empty label and secret_length 0.
+bool key_store_load(unsigned int first_key);
+bool key_store_load_next(void);
+bool key_store_loading(void);
+bool key_store_read_record(const uint8_t *record, int length, char *label, OtpKey *key);
+
+// Secrets, read in with the rest of their page if it is not in RAM. The
+// pointers are only good until the next key_store call, which may replace
+// the page.
+const OtpKey *key_store_key(unsigned int key_id);
+const OtpKey *key_store_page(unsigned int page, unsigned int *count);
+unsigned int key_store_period(unsigned int key_id);
+
+bool key_store_save_key(unsigned int key_id, const OtpKey *key);
+bool key_store_move(unsigned int key_id, unsigned int new_position);
+bool key_store_delete(unsigned int key_id);
+bool key_store_rewrite(void);
+int key_store_find(const OtpKey *key);
+uint32_t key_store_digest(unsigned int key_id);
+uint32_t key_store_record_digest(const uint8_t *record);
+uint32_t key_store_table_digest(void);
@@ -9,6 +9,11 @@
 #include "main.h"
 #include "single_code_window.h"
 #include "multi_code_window.h"
+#include "code_cache.h"
+#include "font_manager.h"
+#include "key_store.h"
+#include "message_queue.h"
+#include "base32.h"
 #include "ctype.h"
 
 // Colors
@@ -19,16 +24,13 @@ int fg_color_int;
 
 // Fonts
 unsigned int font;
-AppFont font_pin;
-AppFont font_label;
 
 bool fonts_changed;
 bool colors_changed;
 bool refresh_required;
 bool loading_complete;
 
-unsigned int js_message_retry_count = 0;
-unsigned int js_message_max_retry_count = 5;
+uint32_t inbox_size = 0;
 
 int timezone_offset = 0;
 
@@ -42,12 +44,26 @@ unsigned int requesting_code = 0;
 unsigned int otp_update_tick = 0;
 unsigned int otp_updated_at_tick = 0;
 unsigned int window_layout = 0;
+#if defined(PBL_PLATFORM_APLITE)
+unsigned int countdown_refresh_time = 60;
+#else
+unsigned int countdown_refresh_time = 30;
+#endif
 
 char otp_labels[MAX_OTP][MAX_LABEL_LENGTH];
-char otp_keys[MAX_OTP][MAX_KEY_LENGTH];
+
+// Keys sent by the phone that there was no room for, as pairs of the digest
+// of the record sent and that of the copy the watch kept, 0 for none. Told
+// to the phone so it stops sending them, see write_rejected_keys(). Cleared
+// by clear_rejected_keys() once no message still has to write them.
+static uint8_t rejected_keys[MAX_BATCH_KEYS * 8];
+static unsigned int rejected_count = 0;
+
+AppTimer *key_load_timer;
 
 // Functions requiring early declaration
-void request_key(int code_id);
+void request_keys(int first_key);
+int add_key(const char *otp_label, int label_length, const OtpKey *new_key, bool new_code);
 void send_key(int requested_key);
 void main_animate_second_counter(int seconds, bool off_screen);
 
@@ -55,6 +71,25 @@ void resetIdleTime() {
   idle_second_count = 0;
 }
 
+// Delay before the next countdown frame, or 0 to leave it to the second tick.
+// Catching up always runs at the platform frame rate, but a steady countdown
+// is only followed pixel by pixel while someone has recently pressed a button.
+uint32_t countdown_frame_delay(uint32_t next_change) {
+  if (next_change <= countdown_refresh_time)
+    return countdown_refresh_time;
+
+  if (idle_second_count >= COUNTDOWN_IDLE_SECONDS || next_change >= 1000)
+    return 0;
+
+  return next_change;
+}
+
+// Time step of the selected key, which the countdown follows
+unsigned int selected_period(void) {
+  unsigned int period = key_store_period(otp_selected);
+  return period > 0 ? period : TIME_STEP_SECONDS;
+}
+
 void refresh_screen(void) {
   if (loading_complete)
     refresh_required = true;
@@ -86,36 +121,52 @@ void switch_window_layout(void) {
   update_window_layout();
 }
 
-void write_key(char label[MAX_LABEL_LENGTH], char key[MAX_KEY_LENGTH], unsigned int location) {
-  char combined_key[MAX_COMBINED_LENGTH];
-  snprintf(combined_key, sizeof(combined_key), "%s:%s",label,key);
-  persist_write_string(PS_SECRET+location, combined_key);
+// Rebuilds the "label:key" text the phone uses for a loaded key.
+void format_key_text(unsigned int key_id, char keylabelpair[MAX_COMBINED_LENGTH]) {
+  const OtpKey *key = key_store_key(key_id);
+  int label_length = snprintf(keylabelpair, MAX_COMBINED_LENGTH, "%s:", otp_labels[key_id]);
+  base32_encode(key->secret, key->secret_length,
+                (uint8_t *)keylabelpair + label_length, MAX_COMBINED_LENGTH - label_length);
 }
 
-void move_key_position(unsigned int key_position, unsigned int new_position) {
-  char label_buffer[MAX_LABEL_LENGTH];
-  char key_buffer[MAX_KEY_LENGTH];
+static void keys_loaded(void) {
+  key_load_timer = NULL;
+  code_cache_invalidate();
 
-  strcpy(label_buffer, otp_labels[key_position]);
-  strcpy(key_buffer, otp_keys[key_position]);
+  if (otp_default >= watch_otp_count)
+    otp_default = 0;
+  if (otp_selected >= watch_otp_count)
+    otp_selected = otp_default;
 
-  if (key_position > new_position) {	
-    for (unsigned int i = key_position; i > new_position; i--) {
-      strcpy(otp_labels[i], otp_labels[i-1]);
-      strcpy(otp_keys[i], otp_keys[i-1]);
-      write_key(otp_labels[i], otp_keys[i], i);
-    }
-  } else if (new_position > key_position) {
-    for (unsigned int i = key_position; i < new_position; i++) {
-      strcpy(otp_labels[i], otp_labels[i+1]);
-      strcpy(otp_keys[i], otp_keys[i+1]);
-      write_key(otp_labels[i], otp_keys[i], i);
-    }
-  }
+  DEBUG_LOG("INFO: LOADED %d CODES", watch_otp_count);
 
-  strcpy(otp_labels[new_position], label_buffer);
-  strcpy(otp_keys[new_position], key_buffer);
-  write_key(otp_labels[new_position], otp_keys[new_position], new_position);
+  // The single code window already shows the key loaded first
+  if (window_layout == 1)
+    refresh_screen();
+}
+
+static void key_load_callback(void *data) {
+  if (key_store_load_next())
+    key_load_timer = app_timer_register(KEY_LOAD_INTERVAL, key_load_callback, NULL);
+  else
+    keys_loaded();
+}
+
+// Anything that changes or sends keys needs the whole table
+static void finish_loading_keys(void) {
+  if (!key_store_loading())
+    return;
+
+  if (key_load_timer)
+    app_timer_cancel(key_load_timer);
+  while (key_store_load_next());
+  keys_loaded();
+}
+
+void move_key_position(unsigned int key_position, unsigned int new_position) {
+  finish_loading_keys();
+  key_store_move(key_position, new_position);
+  code_cache_invalidate();
 
   if (otp_default == key_position)
     set_default_key(new_position, false);
@@ -175,149 +226,244 @@ void set_default_key(int key_id, bool force_refresh) {
   }
 }
 
-void expand_key(char *inputString, bool new_code) {
-  if (strstr(inputString, ":") == NULL) {
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: SUPER NULL input string, ignoring");
-    return;
+// Result of expand_key() and add_key()
+enum {
+  KEY_SAVED = 0,
+  KEY_INVALID = -1, // Nothing the watch can use, so nothing to keep
+  KEY_NO_ROOM = -2 // The key table or the key store is full
+};
+
+// Parses a "label:key" string in place, reading at most size bytes. The
+// label goes straight into the key table and the key is decoded from the
+// buffer it arrived in, so nothing is copied along the way.
+int expand_key(const char *text, int size, bool new_code) {
+  int colon = -1;
+  int end = 0;
+  while (end < size && text[end] != '\0') {
+    if (colon < 0 && text[end] == ':')
+      colon = end;
+    end++;
   }
 
-  bool colonFound = false;
-  int outputChar = 0;
-
-  char otp_key[MAX_KEY_LENGTH];
-  char otp_label[MAX_LABEL_LENGTH];
-
-  for(unsigned int i = 0; i < strlen(inputString); i++) {
-    if (inputString[i] == ':') {
-      otp_label[outputChar] = '\0';
-      colonFound = true;
-      outputChar = 0;
-    } else {
-      if (colonFound) 
-        otp_key[outputChar] = inputString[i]; 
-      else
-        otp_label[outputChar] = inputString[i];
-
-      outputChar++;
-    }
+  if (colon < 0 || end == size) {
+    DEBUG_LOG("INFO: SUPER NULL input string, ignoring");
+    return KEY_INVALID;
   }
-  otp_key[outputChar] = '\0';
 
   // If the label or key are null ignore them
-  if (strlen(otp_label) <= 0 || strlen(otp_key) <= 2) {
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: NULL key or label, ignoring");
-    return;
+  if (colon == 0 || colon >= MAX_LABEL_LENGTH || end - colon - 1 <= 2) {
+    DEBUG_LOG("INFO: NULL key or label, ignoring");
+    return KEY_INVALID;
   }
 
-  bool updating_label = false;
-  if (new_code) {
-    for(unsigned int i = 0; i < watch_otp_count; i++) {
-      if (strcmp(otp_key, otp_keys[i]) == 0) {
-        updating_label = true;
-        if (DEBUG) {
-          APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Code exists. Relabeling");
-          APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Saving to location: %d", PS_SECRET+i);
-        }
-
-        strcpy(otp_labels[i], otp_label);
-        persist_write_string(PS_SECRET+i, inputString);
-        if (otp_selected != i)
-          otp_selected = i;
-
-        refresh_screen();
-      }
-    }
+  // Decode once here, the text form is not kept in memory. Keys that cannot
+  // be decoded are not stored as there is nothing to save in binary form.
+  OtpKey new_key;
+  if (!prepareKey(text + colon + 1, &new_key)) {
+    DEBUG_LOG("INFO: Invalid key, ignoring");
+    return KEY_INVALID;
   }
 
-  if (!updating_label) {
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Adding Code");
-    strcpy(otp_keys[watch_otp_count], otp_key);
-    strcpy(otp_labels[watch_otp_count], otp_label);
-    if (new_code) {
-      if (DEBUG)
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Saving to location: %d", PS_SECRET+watch_otp_count);
-      persist_write_string(PS_SECRET+watch_otp_count, inputString);
+  int result = add_key(text, colon, &new_key, new_code);
+  memset(&new_key, 0, sizeof(new_key));
+  return result;
+}
+
+// Adds a key, or relabels it and takes its new options if its secret is
+// already on the watch. The label need not be terminated. Only the key store
+// holds the secret, so a key it has no room for is not added at all and a
+// relabel that cannot be saved keeps the old label.
+int add_key(const char *otp_label, int label_length, const OtpKey *new_key, bool new_code) {
+  int key_id = new_code ? key_store_find(new_key) : -1;
+  if (key_id >= 0) {
+    DEBUG_LOG("INFO: Code exists. Relabeling %d", key_id);
+
+    char old_label[MAX_LABEL_LENGTH];
+    strcpy(old_label, otp_labels[key_id]);
+    memcpy(otp_labels[key_id], otp_label, label_length);
+    otp_labels[key_id][label_length] = '\0';
+    if (!key_store_save_key(key_id, new_key)) {
+      strcpy(otp_labels[key_id], old_label);
+      return KEY_NO_ROOM;
     }
-    watch_otp_count++;
-    otp_selected = watch_otp_count-1;
+    code_cache_invalidate();
+    otp_selected = key_id;
     refresh_screen();
+    return KEY_SAVED;
   }
+
+  if (watch_otp_count >= MAX_OTP)
+    return KEY_NO_ROOM;
+
+  DEBUG_LOG("INFO: Adding Code");
+  memcpy(otp_labels[watch_otp_count], otp_label, label_length);
+  otp_labels[watch_otp_count][label_length] = '\0';
+  watch_otp_count++;
+
+  if (!key_store_save_key(watch_otp_count-1, new_key)) {
+    watch_otp_count--;
+    return KEY_NO_ROOM;
+  }
+  otp_selected = watch_otp_count-1;
+  refresh_screen();
+  return KEY_SAVED;
 }
 
-void check_load_status() {
-  if ((phone_otp_count > 0 && phone_otp_count < requesting_code) || requesting_code > MAX_OTP) {
-    requesting_code = 0;
-    loading_complete = true;
-    refresh_screen();
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: FINISHED REQUESTING");
+static void delete_key(unsigned int key_id) {
+  key_store_delete(key_id);
+  code_cache_invalidate();
+
+  if (otp_selected >= key_id) {
+    if (otp_selected == key_id)
+      refresh_screen();
+    otp_selected--;;
   }
-  else if (requesting_code > 0) {
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: REQUESTING ANOTHER!");
-    request_key(requesting_code++);
+
+  if (otp_default > 0 && otp_default >= key_id)
+    otp_default--;
+}
+
+// Removes keys the phone no longer has, given as a list of their digests
+static void delete_keys_by_digest(const uint8_t *digests, int length) {
+  for (int d = 0; d + 4 <= length; d += 4) {
+    uint32_t digest = digests[d] | digests[d+1] << 8 | digests[d+2] << 16 | (uint32_t)digests[d+3] << 24;
+    for (unsigned int i = 0; i < watch_otp_count; i++) {
+      if (key_store_digest(i) == digest) {
+        DEBUG_LOG("INFO: Deleting key %d", i);
+        delete_key(i);
+        break;
+      }
+    }
   }
 }
 
-void sendJSMessage(Tuplet data_tuple) {
-  DictionaryIterator *iter;
-  int begin = app_message_outbox_begin(&iter);
+static void finish_key_sync(void) {
+  requesting_code = 0;
+  loading_complete = true;
+  refresh_screen();
+  DEBUG_LOG("INFO: FINISHED REQUESTING");
+}
+
+static void write_digest(uint8_t *bytes, uint32_t digest) {
+  bytes[0] = digest;
+  bytes[1] = digest >> 8;
+  bytes[2] = digest >> 16;
+  bytes[3] = digest >> 24;
+}
+
+// Writes the first count rejected keys, the list as it was when the message
+// was queued. Entries are only added behind them until it has been sent.
+static void write_rejected_keys(DictionaryIterator *iter, int count, const char *text) {
+  if ((unsigned int)count > rejected_count)
+    count = rejected_count;
+  dict_write_data(iter, MESSAGE_KEY_rejected_keys, rejected_keys, count * 8);
+}
+
+// The phone adds each list it gets to the ones before, so the list can start
+// again once every message writing it has gone
+static void clear_rejected_keys(void) {
+  if (!message_queue_waiting(write_rejected_keys))
+    rejected_count = 0;
+}
+
+// Keys arrive as binary records, see key_store.h. Returns false if there was
+// no room for the key.
+static bool receive_record(Tuple *record_tuple) {
+  char otp_label[MAX_LABEL_LENGTH];
+  OtpKey new_key;
+
+  if (!key_store_read_record(record_tuple->value->data, record_tuple->length, otp_label, &new_key)) {
+    DEBUG_LOG("INFO: Invalid key record, ignoring");
+    return true;
+  }
 
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Begin send JSMessage = %d", begin);
+  bool saved = add_key(otp_label, strlen(otp_label), &new_key, true) != KEY_NO_ROOM;
+  if (!saved) {
+    if (rejected_count < MAX_BATCH_KEYS) {
+      int key_id = key_store_find(&new_key);
+      write_digest(&rejected_keys[rejected_count*8], key_store_record_digest(record_tuple->value->data));
+      write_digest(&rejected_keys[rejected_count*8+4], key_id >= 0 ? key_store_digest(key_id) : 0);
+      rejected_count++;
+    } else {
+      APP_LOG(APP_LOG_LEVEL_ERROR, "ERROR: Too many rejected keys to tell the phone");
+    }
+  }
+  memset(&new_key, 0, sizeof(new_key));
+  return saved;
+}
 
-  if (iter == NULL) {
+// A batch holds keys requesting_code onwards in transmit_keys[0], [1] ...
+// Batches that do not start where the last one ended are ignored. The last
+// batch may also list the digests of keys to delete.
+static void receive_keys(DictionaryIterator *iter, unsigned int sequence, bool end, Tuple *delete_tuple) {
+  if (requesting_code == 0 || sequence != requesting_code) {
+    DEBUG_LOG("INFO: Ignoring batch %d, expecting %d", sequence, requesting_code);
     return;
   }
 
-  dict_write_tuplet(iter, &data_tuple);
-  dict_write_end(iter);
+  clear_rejected_keys();
+  bool full = false;
+  unsigned int count = 0;
+  Tuple *key_tuple;
+  while (count < MAX_BATCH_KEYS && (key_tuple = dict_find(iter, MESSAGE_KEY_transmit_keys + count)) != NULL) {
+    if (!receive_record(key_tuple))
+      full = true;
+    count++;
+  }
+  requesting_code += count;
+
+  DEBUG_LOG("INFO: Received %d keys", count);
+  if (full)
+    message_queue_send(write_rejected_keys, rejected_count, NULL);
+
+  if (end || count == 0 || requesting_code > MAX_OTP) {
+    if (end && delete_tuple)
+      delete_keys_by_digest(delete_tuple->value->data, delete_tuple->length);
+    finish_key_sync();
+  } else {
+    DEBUG_LOG("INFO: REQUESTING ANOTHER!");
+    request_keys(requesting_code);
+  }
+}
 
-  int send = app_message_outbox_send();
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Send send JSMessage = %d", send);
+static void write_text_message(DictionaryIterator *iter, int message_key, const char *text) {
+  dict_write_cstring(iter, message_key, text);
 }
 
 void request_delete(int key_id) {
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Pebble Requesting delete: %s", otp_keys[key_id]);
+  char keylabelpair[MAX_COMBINED_LENGTH];
+  format_key_text(key_id, keylabelpair);
+  char *key = strchr(keylabelpair, ':') + 1;
 
-  sendJSMessage(MyTupletCString(MESSAGE_KEY_delete_key, otp_keys[key_id]));
+  DEBUG_LOG("INFO: Pebble Requesting delete: %s", key);
+
+  message_queue_send(write_text_message, MESSAGE_KEY_delete_key, key);
 }
 
 void out_sent_handler(DictionaryIterator *sent, void *context) {
   // outgoing message was delivered
-  js_message_retry_count = 0;
-
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Outgoing Message Delivered");
+  DEBUG_LOG("INFO: Outgoing Message Delivered");
+  message_queue_sent();
 }
 
 void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, void *context) {
-  // outgoing message failed
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Outgoing Message Failed");
-
-  if (requesting_code > 0 && js_message_retry_count < js_message_max_retry_count) {
-    js_message_retry_count++;
-
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: RETRY:%d REQUESTING ANOTHER!", js_message_retry_count);
-
-    request_key(requesting_code);
-  }
+  // outgoing message failed, the queue retries it with a growing delay
+  message_queue_failed(reason);
 }
 
 static void in_received_handler(DictionaryIterator *iter, void *context) {
   // Check for fields you expect to receive
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Message Received");
+  DEBUG_LOG("INFO: Message Received");
 
   resetIdleTime();
+  finish_loading_keys();
   Tuple *key_count_tuple = dict_find(iter, MESSAGE_KEY_key_count);
   Tuple *key_tuple = dict_find(iter, MESSAGE_KEY_transmit_key);
+  Tuple *record_tuple = dict_find(iter, MESSAGE_KEY_transmit_record);
+  Tuple *sync_sequence_tuple = dict_find(iter, MESSAGE_KEY_sync_sequence);
+  Tuple *sync_end_tuple = dict_find(iter, MESSAGE_KEY_sync_end);
+  Tuple *table_digest_tuple = dict_find(iter, MESSAGE_KEY_table_digest);
+  Tuple *delete_digests_tuple = dict_find(iter, MESSAGE_KEY_delete_digests);
   Tuple *timezone_tuple = dict_find(iter, MESSAGE_KEY_timezone);
   Tuple *key_delete_tuple = dict_find(iter, MESSAGE_KEY_delete_key);
   Tuple *font_tuple = dict_find(iter, MESSAGE_KEY_font);
@@ -331,57 +477,46 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
   if (key_count_tuple) {
     phone_otp_count = key_count_tuple->value->int16;
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Key count from watch: %d", watch_otp_count);
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Key count from phone: %d", phone_otp_count);
+    DEBUG_LOG("INFO: Key count from watch: %d", watch_otp_count);
+    DEBUG_LOG("INFO: Key count from phone: %d", phone_otp_count);
+  } // key_count_tuple
+
+  // Only keys whose digests differ are sent, see request_keys()
+  if (table_digest_tuple) {
+    uint32_t table_digest = table_digest_tuple->value->uint32;
+    DEBUG_LOG("INFO: Table digest watch: %u phone: %u", (unsigned int)key_store_table_digest(), (unsigned int)table_digest);
 
-    if (watch_otp_count < phone_otp_count) {
-      if (DEBUG)
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: REQUESTING CODES");
+    if (table_digest != key_store_table_digest()) {
+      DEBUG_LOG("INFO: REQUESTING CODES");
       loading_complete = false;
       requesting_code = 1;
-      request_key(requesting_code++);
+      request_keys(requesting_code);
     }
-  } // key_count_tuple
+  } // table_digest_tuple
 
-  if (key_tuple) {
-    char key_value[MAX_COMBINED_LENGTH];
-    memcpy(key_value, key_tuple->value->cstring, key_tuple->length);
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Text: %s", key_value);
-    expand_key(key_value, true);
-    check_load_status();
-  } // key_tuple
-
-  if (key_delete_tuple) {
-    char key_value[MAX_COMBINED_LENGTH];
-    memcpy(key_value, key_delete_tuple->value->cstring, key_delete_tuple->length);
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Deleting requested Key: %s", key_value);
-
-    unsigned int key_found = MAX_OTP;
-    for(unsigned int i = 0; i < watch_otp_count; i++) {
-      if (strcmp(key_value, otp_keys[i]) == 0)
-        key_found = i;
-    }
+  if (key_tuple)
+    expand_key(key_tuple->value->cstring, key_tuple->length, true);
 
-    if(key_found < MAX_OTP) {
-      for (unsigned int i = key_found; i < watch_otp_count; i++) {
-        strcpy(otp_keys[i], otp_keys[i+1]);
-        strcpy(otp_labels[i], otp_labels[i+1]);
-        write_key(otp_labels[i], otp_keys[i], i);
-      }
-      watch_otp_count--;
-      persist_delete(PS_SECRET+watch_otp_count);
+  if (record_tuple) {
+    clear_rejected_keys();
+    if (!receive_record(record_tuple))
+      message_queue_send(write_rejected_keys, rejected_count, NULL);
+  }
 
-      if (otp_selected >= key_found) {
-        if (otp_selected == key_found)
-          refresh_screen();
-        otp_selected--;;
-      }
+  if (sync_sequence_tuple)
+    receive_keys(iter, sync_sequence_tuple->value->int32, sync_end_tuple != NULL, delete_digests_tuple);
 
-      if (otp_default > 0 && otp_default >= key_found)
-        otp_default--;
-    }
+  // The key is decoded where it arrived, provided it ends inside the tuple
+  if (key_delete_tuple && memchr(key_delete_tuple->value->cstring, '\0', key_delete_tuple->length)) {
+    DEBUG_LOG("INFO: Deleting requested Key: %s", key_delete_tuple->value->cstring);
+
+    OtpKey deleted_key;
+    prepareKey(key_delete_tuple->value->cstring, &deleted_key);
+
+    int key_found = key_store_find(&deleted_key);
+    if (key_found >= 0)
+      delete_key(key_found);
+    memset(&deleted_key, 0, sizeof(deleted_key));
   } // key_delete_tuple
 
   if (timezone_tuple) {
@@ -390,11 +525,11 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
       timezone_offset = tz_offset;
       persist_write_int(PS_TIMEZONE_KEY, timezone_offset);
       #ifdef PBL_SDK_2
+      code_cache_invalidate();
       refresh_screen();
       #endif
     }
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Timezone Offset: %d", timezone_offset);
+    DEBUG_LOG("INFO: Timezone Offset: %d", timezone_offset);
   } // timezone_tuple
 
   int fg_color_value = fg_color_int;
@@ -412,10 +547,8 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
     fg_color_int = fg_color_value;
     bg_color_int = bg_color_value;
     
-    if (DEBUG) {
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: fg_color : %d", fg_color_int);
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: bg_color : %d", bg_color_int);
-    }
+    DEBUG_LOG("INFO: fg_color : %d", fg_color_int);
+    DEBUG_LOG("INFO: bg_color : %d", bg_color_int);
     persist_write_int(PS_FOREGROUND_COLOR, fg_color_int);
     persist_write_int(PS_BACKGROUND_COLOR, bg_color_int);
     notify_color_change();
@@ -428,8 +561,7 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
       persist_write_int(PS_FONT, font);
       update_screen_fonts();
     }
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Font : %d", font);
+    DEBUG_LOG("INFO: Font : %d", font);
   } // font_tuple
 
   if (window_layout_tuple) {
@@ -440,8 +572,7 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
       persist_write_int(PS_WINDOW_LAYOUT, window_layout);
       update_window_layout();
     }
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Window Layout: %d", window_layout);
+    DEBUG_LOG("INFO: Window Layout: %d", window_layout);
   } // window_layout_tuple
 
   if (idle_timeout_tuple) {
@@ -456,8 +587,7 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
       idle_timeout = 0;
 
     resetIdleTime();
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Idle Timeout: %d", idle_timeout);
+    DEBUG_LOG("INFO: Idle Timeout: %d", idle_timeout);
   } // idle_timeout_tuple
 
   if (key_request_tuple) {
@@ -468,33 +598,42 @@ static void in_received_handler(DictionaryIterator *iter, void *context) {
 
 void in_dropped_handler(AppMessageResult reason, void *context) {
   // incoming message dropped
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Incoming Message Dropped");
+  DEBUG_LOG("INFO: Incoming Message Dropped");
+}
+
+// Asks the phone for keys first_key onwards, as many as fit in our inbox.
+// The first request carries the digest of every key on the watch so the
+// phone only sends the ones that are new or changed. Written when the
+// message is sent so a retry carries current digests.
+static void write_key_request(DictionaryIterator *iter, int first_key, const char *text) {
+  dict_write_int16(iter, MESSAGE_KEY_request_key, first_key);
+  dict_write_uint32(iter, MESSAGE_KEY_sync_inbox_size, inbox_size);
+
+  if (first_key == 1 && watch_otp_count > 0) {
+    uint8_t digests[MAX_OTP * 4];
+    for (unsigned int i = 0; i < watch_otp_count; i++)
+      write_digest(&digests[i*4], key_store_digest(i));
+    dict_write_data(iter, MESSAGE_KEY_record_digests, digests, watch_otp_count * 4);
+  }
 }
 
-void request_key(int code_id) {
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Requesting code: %d", code_id);
+void request_keys(int first_key) {
+  DEBUG_LOG("INFO: Requesting codes from: %d", first_key);
 
-  sendJSMessage(TupletInteger(MESSAGE_KEY_request_key, code_id));
+  message_queue_send(write_key_request, first_key, NULL);
 }
 
 void send_key(int requested_key) {
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Phone Requesting key: %d", requested_key);
+  DEBUG_LOG("INFO: Phone Requesting key: %d", requested_key);
 
   char keylabelpair[MAX_COMBINED_LENGTH];
 
-  if (persist_exists(PS_SECRET+requested_key)) {
-    if (DEBUG)
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: SENDING CODE FROM LOCATION %d", PS_SECRET+requested_key);
-
-    persist_read_string(PS_SECRET+requested_key, keylabelpair, MAX_COMBINED_LENGTH);
-  }
+  if (requested_key >= 0 && (unsigned int)requested_key < watch_otp_count)
+    format_key_text(requested_key, keylabelpair);
   else
-    strcat(keylabelpair,"NULL");
+    strcpy(keylabelpair,"NULL");
 
-  sendJSMessage(MyTupletCString(MESSAGE_KEY_transmit_key, keylabelpair));
+  message_queue_send(write_text_message, MESSAGE_KEY_transmit_key, keylabelpair);
 }
 
 void set_default_colors() {
@@ -514,7 +653,7 @@ void apply_new_colors() {
 	if (bg_color_int == fg_color_int) {
 // 		int intensity = (((bg_color_int & 0xFF000000) >> 24) + ((bg_color_int & 0x00FF0000) >> 16) + ((bg_color_int & 0x0000FF00) >> 8)) / 3;
 		int intensity = (((bg_color_int >> 16) & 0xff) + ((bg_color_int >> 8) & 0xff) + ((bg_color_int >> 0) & 0xff))/3;
-		APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: INTENSITY %d", intensity);
+		DEBUG_LOG("INFO: INTENSITY %d", intensity);
 		if (intensity <= 127)
 			fg_color_int = 16777215;
 		else
@@ -525,7 +664,46 @@ void apply_new_colors() {
 	bg_color = GColorFromHEX(bg_color_int);
 }
 
+// Moves keys saved by an older version, one "label:key" string per slot, over
+// to the key store a key at a time. Each slot is deleted once its key is
+// saved, which frees the room for the next. Keys the store has no room for
+// keep their slots and PS_LEGACY_NEXT, and are tried again next launch.
+static void move_legacy_keys(int first_slot) {
+  int left = 0;
+
+  if (!persist_exists(PS_LEGACY_NEXT))
+    persist_write_int(PS_LEGACY_NEXT, first_slot);
+
+  for (int i = first_slot; i < LEGACY_MAX_OTP; i++) {
+    if (!persist_exists(PS_SECRET+i))
+      continue;
+
+    if (left == 0) {
+      DEBUG_LOG("INFO: MOVING CODE FROM LOCATION %d", PS_SECRET+i);
+
+      char keylabelpair[MAX_COMBINED_LENGTH];
+      persist_read_string(PS_SECRET+i, keylabelpair, MAX_COMBINED_LENGTH);
+      int result = expand_key(keylabelpair, sizeof(keylabelpair), true);
+      memset(keylabelpair, 0, sizeof(keylabelpair));
+
+      if (result != KEY_NO_ROOM) {
+        persist_delete(PS_SECRET+i);
+        continue;
+      }
+      if (i != first_slot)
+        persist_write_int(PS_LEGACY_NEXT, i);
+    }
+    left++;
+  }
+
+  if (left == 0)
+    persist_delete(PS_LEGACY_NEXT);
+  else
+    APP_LOG(APP_LOG_LEVEL_ERROR, "ERROR: No room to move %d keys saved by an older version", left);
+}
+
 void load_persistent_data() {	
+  INSTRUMENT_BEGIN(PROBE_LOAD);
   timezone_offset = persist_exists(PS_TIMEZONE_KEY) ? persist_read_int(PS_TIMEZONE_KEY) : 0;
 
   fg_color_int = persist_exists(PS_FOREGROUND_COLOR) ? persist_read_int(PS_FOREGROUND_COLOR) : -1;
@@ -541,45 +719,35 @@ void load_persistent_data() {
   idle_timeout = persist_exists(PS_IDLE_TIMEOUT) ? persist_read_int(PS_IDLE_TIMEOUT) : 300;
   window_layout = persist_exists(PS_WINDOW_LAYOUT) ? persist_read_int(PS_WINDOW_LAYOUT) : 0;
 
-  if (persist_exists(PS_SECRET)) {
-    for(int i = 0; i < MAX_OTP; i++) {
-      if (persist_exists(PS_SECRET+i)) {
-        if (DEBUG)
-          APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: LOADING CODE FROM LOCATION %d", PS_SECRET+i);
-
-        char keylabelpair[MAX_COMBINED_LENGTH];
-        persist_read_string(PS_SECRET+i, keylabelpair, MAX_COMBINED_LENGTH);
-
-        if (DEBUG)
-          APP_LOG(APP_LOG_LEVEL_DEBUG, "'%s'", keylabelpair);
-
-        expand_key(keylabelpair, false);
-      }
-      else
-        break;
-    }
+  code_cache_invalidate();
+  if (key_store_load(otp_default)) {
+    if (key_store_loading())
+      key_load_timer = app_timer_register(KEY_LOAD_INTERVAL, key_load_callback, NULL);
   } else
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: NO CODES ON WATCH!");
+    DEBUG_LOG("INFO: NO CODES ON WATCH!");
+
+  bool legacy_moving = persist_exists(PS_LEGACY_NEXT);
+  if (legacy_moving || persist_exists(PS_SECRET)) {
+    finish_loading_keys();
+    move_legacy_keys(legacy_moving ? persist_read_int(PS_LEGACY_NEXT) : 0);
+  }
 
   if (otp_default >= watch_otp_count)
     otp_default = 0;
 
   otp_selected = otp_default;
+  INSTRUMENT_END(PROBE_LOAD);
 }
 
 static void handle_second_tick(struct tm *tick_time, TimeUnits units_changed) {
 
-  if (idle_timeout > 0) {
-    // If app is idle after X minutes then exit
-    if (idle_second_count >= idle_timeout) {
-      if (DEBUG)
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: Timer reached %d, exiting", idle_second_count);
-      window_stack_pop_all(true);
-      return;
-    }
-    else
-      idle_second_count += 1;
+  // If app is idle after X minutes then exit
+  if (idle_timeout > 0 && idle_second_count >= idle_timeout) {
+    DEBUG_LOG("INFO: Timer reached %d, exiting", idle_second_count);
+    window_stack_pop_all(true);
+    return;
   }
+  idle_second_count += 1;
 
   if (window_layout == 1)
     multi_code_window_second_tick(tick_time->tm_sec);
@@ -588,6 +756,7 @@ static void handle_second_tick(struct tm *tick_time, TimeUnits units_changed) {
 }
 
 void handle_init(void) {
+  INSTRUMENT_BEGIN(PROBE_INIT);
   load_persistent_data();
   tick_timer_service_subscribe(SECOND_UNIT, &handle_second_tick);
 
@@ -597,12 +766,13 @@ void handle_init(void) {
   app_message_register_outbox_failed(out_failed_handler);
 
 	#if defined(PBL_PLATFORM_APLITE)
-	int result = app_message_open(750, 750);
+	inbox_size = 750;
+	int result = app_message_open(inbox_size, 750);
 	#else
-	int result = app_message_open(app_message_inbox_size_maximum(), app_message_outbox_size_maximum());    //Largest possible input and output buffer size
+	inbox_size = app_message_inbox_size_maximum();
+	int result = app_message_open(inbox_size, app_message_outbox_size_maximum());    //Largest possible input and output buffer size
 	#endif
-	if (DEBUG)
-		APP_LOG(APP_LOG_LEVEL_DEBUG, "APP_MESSAGE_OPEN: %d", result);
+	DEBUG_LOG("APP_MESSAGE_OPEN: %d", result);
 
 
   if (window_layout == 1)
@@ -611,11 +781,12 @@ void handle_init(void) {
     single_code_window_push();
 
   loading_complete = true;
+  INSTRUMENT_END(PROBE_INIT);
 }
 
 void handle_deinit(void) {
-  if (DEBUG)
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "INFO: EXITING");
+  DEBUG_LOG("INFO: EXITING");
+  INSTRUMENT_DUMP();
 
   tick_timer_service_unsubscribe();
   animation_unschedule_all();
@@ -625,14 +796,12 @@ void handle_deinit(void) {
   else
     single_code_window_remove();
 
-  if (font_label.isCustom)
-    fonts_unload_custom_font(font_label.font);
-  if (font_pin.isCustom)
-    fonts_unload_custom_font(font_pin.font);
+  font_manager_unload();
 }
 
 int main(void) {
   handle_init();
   app_event_loop();
   handle_deinit();
+  return 0;
 }
\ No newline at end of file
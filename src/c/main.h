@@ -7,18 +7,16 @@
 
 #pragma once
 #include "pebble.h"
+#include "google-authenticator.h"
+#include "instrument.h"
 	
-typedef struct {
-	GFont font;
-	bool isCustom;
-} AppFont;
-
-#define MAX_OTP 30
+#define MAX_OTP 100 // See key_store.h for how many fit in persistent storage
+#define LEGACY_MAX_OTP 30 // Keys saved as "label:key" strings by older versions
+#define MAX_BATCH_KEYS 30 // Size of the transmit_keys array in package.json
 #define MAX_LABEL_LENGTH 21 // 20 + termination
 #define MAX_KEY_LENGTH 129 // 128 + termination
 #define MAX_COMBINED_LENGTH MAX_LABEL_LENGTH+MAX_KEY_LENGTH
 #define APP_VERSION 33
-#define DEBUG false
 
 #define MyTupletCString(_key, _cstring) \
 ((const Tuplet) { .type = TUPLE_CSTRING, .key = _key, .cstring = { .data = _cstring, .length = strlen(_cstring) + 1 }})
@@ -32,7 +30,11 @@ enum {
 	PS_FOREGROUND_COLOR,
 	PS_BACKGROUND_COLOR,
 	PS_WINDOW_LAYOUT,
-	PS_SECRET = 0x40 // Needs 30 spaces, should always be last
+	PS_LEGACY_NEXT, // First PS_SECRET slot still to move to the key store
+	PS_SECRET = 0x40, // "label:key" strings saved before the key store, read once to migrate. Needs LEGACY_MAX_OTP spaces
+	PS_KEY_STORE = 0x60,
+	PS_KEY_ORDER,
+	PS_KEY_BLOCK // Needs MAX_KEY_BLOCKS spaces, should always be last
 };
 
 
@@ -46,11 +48,8 @@ enum {
 
 extern GColor bg_color;
 extern GColor fg_color;
-extern AppFont font_pin;
-extern AppFont font_label;
 
 extern char otp_labels[MAX_OTP][MAX_LABEL_LENGTH];
-extern char otp_keys[MAX_OTP][MAX_KEY_LENGTH];
 
 extern unsigned int font;
 extern unsigned int watch_otp_count;
@@ -58,11 +57,8 @@ extern unsigned int otp_selected;
 extern unsigned int otp_update_tick;
 extern unsigned int otp_updated_at_tick;
 extern int timezone_offset;
-#if defined(PBL_PLATFORM_APLITE)
-static unsigned int countdown_refresh_time = 60;
-#else
-static unsigned int countdown_refresh_time = 30;
-#endif
+extern unsigned int countdown_refresh_time;
+#define COUNTDOWN_IDLE_SECONDS 10 // after this the countdown only moves with the second tick
 extern bool loading_complete;
 extern bool refresh_required;
 extern bool fonts_changed;
@@ -71,6 +67,8 @@ extern bool colors_changed;
 void set_default_key(int key_id, bool force_refresh);
 void request_delete(int key_id);
 void resetIdleTime();
+uint32_t countdown_frame_delay(uint32_t next_change);
+unsigned int selected_period(void);
 void switch_window_layout();
 void animate_layer(Layer *layer, AnimationCurve curve, GRect *start, GRect *finish, int duration, AnimationStoppedHandler callback);
 void add_countdown_layer(struct Layer *window_layer);
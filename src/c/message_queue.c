@@ -0,0 +1,131 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#include "pebble.h"
+#include "message_queue.h"
+
+typedef struct {
+	MessageWriter writer;
+	int value;
+	char text[MAX_COMBINED_LENGTH];
+	unsigned int attempts;
+} QueuedMessage;
+
+static QueuedMessage queue[MESSAGE_QUEUE_LENGTH];
+static unsigned int queue_head;
+static unsigned int queue_count;
+static bool in_flight;
+static AppTimer *retry_timer;
+
+static void try_send(void);
+
+static void retry_callback(void *data) {
+	retry_timer = NULL;
+	try_send();
+}
+
+static void retry_later(void) {
+	QueuedMessage *message = &queue[queue_head];
+
+	if (++message->attempts > MESSAGE_MAX_RETRIES) {
+		APP_LOG(APP_LOG_LEVEL_ERROR, "ERROR: Dropping message after %d attempts", message->attempts);
+		memset(message, 0, sizeof(QueuedMessage));
+		queue_head = (queue_head + 1) % MESSAGE_QUEUE_LENGTH;
+		queue_count--;
+		try_send();
+		return;
+	}
+
+	uint32_t delay = MESSAGE_RETRY_DELAY << (message->attempts - 1);
+	DEBUG_LOG("INFO: RETRY:%d in %dms", message->attempts, (int)delay);
+	retry_timer = app_timer_register(delay, retry_callback, NULL);
+}
+
+static void try_send(void) {
+	if (in_flight || retry_timer || queue_count == 0)
+		return;
+
+	QueuedMessage *message = &queue[queue_head];
+	DictionaryIterator *iter;
+	AppMessageResult result = app_message_outbox_begin(&iter);
+
+	DEBUG_LOG("INFO: Begin send JSMessage = %d", result);
+
+	if (result != APP_MSG_OK || iter == NULL) {
+		retry_later();
+		return;
+	}
+
+	message->writer(iter, message->value, message->text);
+	dict_write_end(iter);
+
+	result = app_message_outbox_send();
+	DEBUG_LOG("INFO: Send send JSMessage = %d", result);
+
+	if (result != APP_MSG_OK)
+		retry_later();
+	else
+		in_flight = true;
+}
+
+bool message_queue_send(MessageWriter writer, int value, const char *text) {
+	if (text == NULL)
+		text = "";
+
+	// The head may already be in the outbox, anything behind it is fair game
+	for (unsigned int i = in_flight ? 1 : 0; i < queue_count; i++) {
+		QueuedMessage *message = &queue[(queue_head + i) % MESSAGE_QUEUE_LENGTH];
+		if (message->writer == writer && message->value == value && strcmp(message->text, text) == 0)
+			return true;
+	}
+
+	if (queue_count == MESSAGE_QUEUE_LENGTH) {
+		APP_LOG(APP_LOG_LEVEL_ERROR, "ERROR: Message queue full");
+		return false;
+	}
+
+	QueuedMessage *message = &queue[(queue_head + queue_count) % MESSAGE_QUEUE_LENGTH];
+	message->writer = writer;
+	message->value = value;
+	strncpy(message->text, text, MAX_COMBINED_LENGTH-1);
+	message->text[MAX_COMBINED_LENGTH-1] = '\0';
+	message->attempts = 0;
+	queue_count++;
+
+	try_send();
+	return true;
+}
+
+// True while a message from writer is queued or in the outbox, when it may
+// still be written again
+bool message_queue_waiting(MessageWriter writer) {
+	for (unsigned int i = 0; i < queue_count; i++) {
+		if (queue[(queue_head + i) % MESSAGE_QUEUE_LENGTH].writer == writer)
+			return true;
+	}
+	return false;
+}
+
+void message_queue_sent(void) {
+	if (!in_flight)
+		return;
+
+	in_flight = false;
+	memset(&queue[queue_head], 0, sizeof(QueuedMessage));
+	queue_head = (queue_head + 1) % MESSAGE_QUEUE_LENGTH;
+	queue_count--;
+	try_send();
+}
+
+void message_queue_failed(AppMessageResult reason) {
+	if (!in_flight)
+		return;
+
+	DEBUG_LOG("INFO: Outgoing Message Failed: %d", reason);
+	in_flight = false;
+	retry_later();
+}
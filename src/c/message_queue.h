@@ -0,0 +1,25 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+#include "pebble.h"
+#include "main.h"
+
+#define MESSAGE_QUEUE_LENGTH 4
+#define MESSAGE_MAX_RETRIES 5
+#define MESSAGE_RETRY_DELAY 100 // Milliseconds, doubled after each failed attempt
+
+// Messages to the phone are queued and written out one at a time as the
+// outbox frees up. A writer fills in the dictionary when its turn comes, so
+// a retry always sends current data. A message identical to one still
+// waiting is only sent once.
+typedef void (*MessageWriter)(DictionaryIterator *iter, int value, const char *text);
+
+bool message_queue_send(MessageWriter writer, int value, const char *text);
+bool message_queue_waiting(MessageWriter writer);
+void message_queue_sent(void);
+void message_queue_failed(AppMessageResult reason);
@@ -1,28 +1,34 @@
 #include <pebble.h>
 #include "main.h"
 #include "multi_code_window.h"
-#include "google-authenticator.h"
+#include "code_cache.h"
 #include "select_window.h"
 #include "display.h"
+#include "font_manager.h"
 
 static GRect display_bounds;
 static MenuLayer *multi_code_menu_layer;
 static Layer *multi_code_graphics_layer;
 static Window *multi_code_main_window;
+static GFont label_font;
+static GFont pin_font;
 int menu_cell_height = 0;
 int pin_origin_y = 0;
 bool multi_code_exiting = false;
 AppTimer *multi_code_graphics_timer;
 
 void multi_code_refresh_callback(void *data) {
+  multi_code_graphics_timer = NULL;
   if (!multi_code_exiting)
   	layer_mark_dirty(multi_code_graphics_layer);
 }
 
 static void update_graphics(Layer *layer, GContext *ctx) {
-  draw_countdown_graphic(&layer, &ctx, true);
-  if (!multi_code_exiting)
-    multi_code_graphics_timer = app_timer_register(countdown_refresh_time, (AppTimerCallback) multi_code_refresh_callback, NULL);
+  INSTRUMENT_BEGIN(PROBE_FRAME);
+  uint32_t delay = countdown_frame_delay(draw_countdown_graphic(&layer, &ctx, true, selected_period()));
+  INSTRUMENT_END(PROBE_FRAME);
+  if (delay && !multi_code_exiting && !multi_code_graphics_timer)
+    multi_code_graphics_timer = app_timer_register(delay, (AppTimerCallback) multi_code_refresh_callback, NULL);
 }
 
 static uint16_t multi_code_menu_get_num_rows_callback(MenuLayer *menu_layer, uint16_t section_index, void *context) {
@@ -41,13 +47,22 @@ static void multi_code_menu_draw_row_callback(GContext *ctx, Layer *cell_layer,
 		graphics_fill_rect(ctx, bounds, 0, 0);
 	}
 
+	// The menu layer only asks for rows on screen, and their text comes
+	// straight from the code cache, so scrolling only generates codes for
+	// rows not yet shown this time step
+	const char *pin = "123456";
+	const char *label = "EMPTY";
 	if (watch_otp_count >= 1) {
-		graphics_draw_text(ctx, generateCode(otp_keys[cell_index->row], timezone_offset), font_pin.font, GRect(0, pin_origin_y, bounds.size.w, 30), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
-		graphics_draw_text(ctx, otp_labels[cell_index->row], fonts_get_system_font(FONT_KEY_GOTHIC_18), GRect(0, 30, bounds.size.w, 25), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
-	} else {
-		graphics_draw_text(ctx, "123456", font_pin.font, GRect(0, pin_origin_y, bounds.size.w, 30), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
-		graphics_draw_text(ctx, "EMPTY", fonts_get_system_font(FONT_KEY_GOTHIC_18), GRect(0, 30, bounds.size.w, 25), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
+		pin = code_cache_get(cell_index->row);
+		label = otp_labels[cell_index->row];
 	}
+
+	// Long codes get a smaller font, see font_manager_code()
+	if (strlen(pin) > PIN_FONT_DIGITS)
+		graphics_draw_text(ctx, pin, font_manager_code(font, pin), GRect(0, 0, bounds.size.w, 30), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
+	else
+		graphics_draw_text(ctx, pin, pin_font, GRect(0, pin_origin_y, bounds.size.w, 30), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
+	graphics_draw_text(ctx, label, label_font, GRect(0, 30, bounds.size.w, 25), GTextOverflowModeTrailingEllipsis, GTextAlignmentCenter, NULL);
 }
 
 static int16_t multi_code_menu_get_cell_height_callback(struct MenuLayer *menu_layer, MenuIndex *cell_index, void *context) {
@@ -85,31 +100,19 @@ static void multi_code_menu_selection_changed_callback(struct MenuLayer *menu_la
 
 void multi_code_set_fonts(void) {
 	fonts_changed = false;
-	
-	if (font_pin.isCustom)
-		fonts_unload_custom_font(font_pin.font);
-	
+	if (font >= FONT_COUNT)
+		font = 0;
+
+	pin_font = font_manager_pin(font);
 	switch(font)
 	{
-		case 1 :
-			font_pin.font = fonts_get_system_font(FONT_KEY_BITHAM_34_MEDIUM_NUMBERS);
-			font_pin.isCustom = false;
-			pin_origin_y = 0;
-			break;
 		case 2 :
-			font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_DIGITAL_42));
-			font_pin.isCustom = true;
 			pin_origin_y = -8;
 			break;
 		case 3 :
-			font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_BD_CARTOON_30));
-			font_pin.isCustom = true;
 			pin_origin_y = 2;
 			break;
 		default :
-			font = 0;
-			font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_BITWISE_32));
-			font_pin.isCustom = true;
 			pin_origin_y = 0;
 			break;
 	}
@@ -123,6 +126,14 @@ void multi_code_apply_display_colors() {
 }
 
 void multi_code_window_second_tick(int seconds) {
+	// Rows only need drawing again when a new time step brings new codes,
+	// which were made by the prefetch on the quiet ticks before it
+	if (code_cache_fill())
+		layer_mark_dirty(menu_layer_get_layer(multi_code_menu_layer));
+	else
+		code_cache_prefetch();
+	if (!multi_code_graphics_timer)
+		layer_mark_dirty(multi_code_graphics_layer);
 	if (refresh_required) {
 		menu_layer_reload_data(multi_code_menu_layer);
 		menu_layer_set_selected_index(multi_code_menu_layer, MenuIndex(0, otp_selected), MenuRowAlignCenter, true);
@@ -136,13 +147,15 @@ void multi_code_window_second_tick(int seconds) {
 
 static void multi_code_window_load(Window *window) {
 	multi_code_exiting = false;
+	code_cache_fill();
 	Layer *window_layer = window_get_root_layer(window);
 	display_bounds = layer_get_frame(window_layer);
+	label_font = fonts_get_system_font(FONT_KEY_GOTHIC_18);
 	multi_code_set_fonts();
 	GRect menu_bounds = layer_get_bounds(window_layer);
 	menu_bounds.size.h = (display_bounds.size.h - 10) - 2;
 	multi_code_menu_layer = menu_layer_create(menu_bounds);
-	multi_code_graphics_layer = layer_create(display_bounds);
+	multi_code_graphics_layer = layer_create(countdown_graphic_frame(display_bounds));
 	layer_set_update_proc(multi_code_graphics_layer, update_graphics);
 	menu_layer_set_callbacks(multi_code_menu_layer, NULL, (MenuLayerCallbacks) {
 		.get_num_rows = (MenuLayerGetNumberOfRowsInSectionsCallback)multi_code_menu_get_num_rows_callback,
@@ -165,7 +178,9 @@ static void multi_code_window_load(Window *window) {
 
 void multi_code_window_unload(Window *window) {
 	multi_code_exiting = true;
-	app_timer_cancel(multi_code_graphics_timer);
+	if (multi_code_graphics_timer)
+		app_timer_cancel(multi_code_graphics_timer);
+	multi_code_graphics_timer = NULL;
 	menu_layer_destroy(multi_code_menu_layer);
 	layer_destroy(multi_code_graphics_layer);
 	window_destroy(multi_code_main_window);
@@ -0,0 +1,214 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+// SHA256 and SHA512 as specified in FIPS 180-4, written for size rather
+// than speed. Codes are only made once per time step, so a compact loop
+// matters more than unrolled rounds.
+//
+
+#include "string.h"
+#include "sha2.h"
+
+#define ROR32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x,n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t K256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t K512[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static void sha256_transform(uint32_t state[8], const uint8_t block[SHA256_BLOCKSIZE]) {
+  uint32_t w[16];
+  uint32_t s[8];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[i*4] << 24 | (uint32_t)block[i*4+1] << 16 |
+           (uint32_t)block[i*4+2] << 8 | block[i*4+3];
+  }
+  memcpy(s, state, sizeof(s));
+
+  for (int i = 0; i < 64; i++) {
+    if (i >= 16) {
+      uint32_t w15 = w[(i+1) & 15];
+      uint32_t w2 = w[(i+14) & 15];
+      w[i & 15] += (ROR32(w15, 7) ^ ROR32(w15, 18) ^ (w15 >> 3)) + w[(i+9) & 15] +
+                   (ROR32(w2, 17) ^ ROR32(w2, 19) ^ (w2 >> 10));
+    }
+
+    uint32_t t1 = s[7] + (ROR32(s[4], 6) ^ ROR32(s[4], 11) ^ ROR32(s[4], 25)) +
+                  ((s[4] & s[5]) ^ (~s[4] & s[6])) + K256[i] + w[i & 15];
+    uint32_t t2 = (ROR32(s[0], 2) ^ ROR32(s[0], 13) ^ ROR32(s[0], 22)) +
+                  ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    for (int j = 7; j > 0; j--)
+      s[j] = s[j-1];
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+
+  for (int i = 0; i < 8; i++)
+    state[i] += s[i];
+
+  memset(w, 0, sizeof(w));
+  memset(s, 0, sizeof(s));
+}
+
+static void sha512_transform(uint64_t state[8], const uint8_t block[SHA512_BLOCKSIZE]) {
+  uint64_t w[16];
+  uint64_t s[8];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = 0;
+    for (int j = 0; j < 8; j++)
+      w[i] = (w[i] << 8) | block[i*8+j];
+  }
+  memcpy(s, state, sizeof(s));
+
+  for (int i = 0; i < 80; i++) {
+    if (i >= 16) {
+      uint64_t w15 = w[(i+1) & 15];
+      uint64_t w2 = w[(i+14) & 15];
+      w[i & 15] += (ROR64(w15, 1) ^ ROR64(w15, 8) ^ (w15 >> 7)) + w[(i+9) & 15] +
+                   (ROR64(w2, 19) ^ ROR64(w2, 61) ^ (w2 >> 6));
+    }
+
+    uint64_t t1 = s[7] + (ROR64(s[4], 14) ^ ROR64(s[4], 18) ^ ROR64(s[4], 41)) +
+                  ((s[4] & s[5]) ^ (~s[4] & s[6])) + K512[i] + w[i & 15];
+    uint64_t t2 = (ROR64(s[0], 28) ^ ROR64(s[0], 34) ^ ROR64(s[0], 39)) +
+                  ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    for (int j = 7; j > 0; j--)
+      s[j] = s[j-1];
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+
+  for (int i = 0; i < 8; i++)
+    state[i] += s[i];
+
+  memset(w, 0, sizeof(w));
+  memset(s, 0, sizeof(s));
+}
+
+void sha256_init(SHA256_INFO *sha256_info) {
+  static const uint32_t initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(sha256_info->state, initial, sizeof(initial));
+  sha256_info->count = 0;
+  sha256_info->local = 0;
+}
+
+void sha256_update(SHA256_INFO *sha256_info, const uint8_t *buffer, int count) {
+  sha256_info->count += count;
+  while (count > 0) {
+    int i = SHA256_BLOCKSIZE - sha256_info->local;
+    if (i > count)
+      i = count;
+    memcpy(sha256_info->data + sha256_info->local, buffer, i);
+    sha256_info->local += i;
+    buffer += i;
+    count -= i;
+    if (sha256_info->local == SHA256_BLOCKSIZE) {
+      sha256_transform(sha256_info->state, sha256_info->data);
+      sha256_info->local = 0;
+    }
+  }
+}
+
+void sha256_final(SHA256_INFO *sha256_info, uint8_t digest[SHA256_DIGEST_LENGTH]) {
+  uint64_t bits = sha256_info->count << 3;
+  int local = sha256_info->local;
+
+  sha256_info->data[local++] = 0x80;
+  if (local > SHA256_BLOCKSIZE - 8) {
+    memset(sha256_info->data + local, 0, SHA256_BLOCKSIZE - local);
+    sha256_transform(sha256_info->state, sha256_info->data);
+    local = 0;
+  }
+  memset(sha256_info->data + local, 0, SHA256_BLOCKSIZE - 8 - local);
+  for (int i = 0; i < 8; i++)
+    sha256_info->data[SHA256_BLOCKSIZE - 1 - i] = bits >> (i * 8);
+  sha256_transform(sha256_info->state, sha256_info->data);
+
+  for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    digest[i] = sha256_info->state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+void sha512_init(SHA512_INFO *sha512_info) {
+  static const uint64_t initial[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+  memcpy(sha512_info->state, initial, sizeof(initial));
+  sha512_info->count = 0;
+  sha512_info->local = 0;
+}
+
+void sha512_update(SHA512_INFO *sha512_info, const uint8_t *buffer, int count) {
+  sha512_info->count += count;
+  while (count > 0) {
+    int i = SHA512_BLOCKSIZE - sha512_info->local;
+    if (i > count)
+      i = count;
+    memcpy(sha512_info->data + sha512_info->local, buffer, i);
+    sha512_info->local += i;
+    buffer += i;
+    count -= i;
+    if (sha512_info->local == SHA512_BLOCKSIZE) {
+      sha512_transform(sha512_info->state, sha512_info->data);
+      sha512_info->local = 0;
+    }
+  }
+}
+
+// The length field is 128 bits, the top half is always zero for data this size
+void sha512_final(SHA512_INFO *sha512_info, uint8_t digest[SHA512_DIGEST_LENGTH]) {
+  uint64_t bits = sha512_info->count << 3;
+  int local = sha512_info->local;
+
+  sha512_info->data[local++] = 0x80;
+  if (local > SHA512_BLOCKSIZE - 16) {
+    memset(sha512_info->data + local, 0, SHA512_BLOCKSIZE - local);
+    sha512_transform(sha512_info->state, sha512_info->data);
+    local = 0;
+  }
+  memset(sha512_info->data + local, 0, SHA512_BLOCKSIZE - 8 - local);
+  for (int i = 0; i < 8; i++)
+    sha512_info->data[SHA512_BLOCKSIZE - 1 - i] = bits >> (i * 8);
+  sha512_transform(sha512_info->state, sha512_info->data);
+
+  for (int i = 0; i < SHA512_DIGEST_LENGTH; i++)
+    digest[i] = sha512_info->state[i / 8] >> (56 - (i % 8) * 8);
+}
@@ -0,0 +1,45 @@
+//
+// Copyright 2015
+// PebbAuth for the Pebble Smartwatch
+// Author: Kevin Cooper
+// https://github.com/JumpMaster/PebbleAuth
+//
+
+#pragma once
+#include "stdint.h"
+
+// SHA256 and SHA512 for TOTP keys that ask for them. Both keep a rolling 16
+// word message schedule rather than the full 64/80 words, so the only tables
+// are the round constants.
+#define SHA256_BLOCKSIZE     64
+#define SHA256_DIGEST_LENGTH 32
+#define SHA512_BLOCKSIZE     128
+#define SHA512_DIGEST_LENGTH 64
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t count; // bytes hashed so far
+  uint8_t  data[SHA256_BLOCKSIZE];
+  int      local;
+} SHA256_INFO;
+
+typedef struct {
+  uint64_t state[8];
+  uint64_t count; // bytes hashed so far
+  uint8_t  data[SHA512_BLOCKSIZE];
+  int      local;
+} SHA512_INFO;
+
+void sha256_init(SHA256_INFO *sha256_info)
+  __attribute__((visibility("hidden")));
+void sha256_update(SHA256_INFO *sha256_info, const uint8_t *buffer, int count)
+  __attribute__((visibility("hidden")));
+void sha256_final(SHA256_INFO *sha256_info, uint8_t digest[SHA256_DIGEST_LENGTH])
+  __attribute__((visibility("hidden")));
+
+void sha512_init(SHA512_INFO *sha512_info)
+  __attribute__((visibility("hidden")));
+void sha512_update(SHA512_INFO *sha512_info, const uint8_t *buffer, int count)
+  __attribute__((visibility("hidden")));
+void sha512_final(SHA512_INFO *sha512_info, uint8_t digest[SHA512_DIGEST_LENGTH])
+  __attribute__((visibility("hidden")));
@@ -2,8 +2,9 @@
 #include "single_code_window.h"
 #include "main.h"
 #include "select_window.h"
-#include "google-authenticator.h"
+#include "code_cache.h"
 #include "display.h"
+#include "font_manager.h"
 
 // Main Window
 static Window *single_code_main_window;
@@ -29,14 +30,23 @@ bool single_code_exiting = false;
 bool countdown_layer_onscreen = false;
 
 void single_code_refresh_callback(void *data) {
+	single_code_graphics_timer = NULL;
 	if (!single_code_exiting)
 		layer_mark_dirty(single_code_graphics_layer);
 }
 
 static void update_graphics(Layer *layer, GContext *ctx) {
-	draw_countdown_graphic(&layer, &ctx, countdown_layer_onscreen);                               
-	if (!single_code_exiting)
-		single_code_graphics_timer = app_timer_register(countdown_refresh_time, (AppTimerCallback) single_code_refresh_callback, NULL);
+	INSTRUMENT_BEGIN(PROBE_FRAME);
+	uint32_t delay = countdown_frame_delay(draw_countdown_graphic(&layer, &ctx, countdown_layer_onscreen, selected_period()));
+	INSTRUMENT_END(PROBE_FRAME);
+	// With no delay the countdown is left alone until the next tick
+	if (delay && !single_code_exiting && !single_code_graphics_timer)
+		single_code_graphics_timer = app_timer_register(delay, (AppTimerCallback) single_code_refresh_callback, NULL);
+}
+
+static void wake_countdown(void) {
+	if (!single_code_exiting && !single_code_graphics_timer)
+		layer_mark_dirty(single_code_graphics_layer);
 }
 
 
@@ -109,9 +119,10 @@ void animate_label_off() {
 
 void animate_code_on() {
 	if (watch_otp_count)
-		strcpy(pin_text, generateCode(otp_keys[otp_selected], timezone_offset));
+		strcpy(pin_text, code_cache_get(otp_selected));
 	else
 		strcpy(pin_text, "123456");
+	text_layer_set_font(text_pin_layer, font_manager_code(font, pin_text));
 
 	otp_updated_at_tick = otp_update_tick;
 
@@ -168,6 +179,7 @@ void animation_control(void) {
 		animate_code_on();
 		animate_label_on();
 		countdown_layer_onscreen = true;
+		wake_countdown();
 		break;
 		case 20: // animate the code off screen
 		animation_state = 30;
@@ -191,6 +203,7 @@ void animation_control(void) {
 		animation_count = 1;
 		animation_direction = RIGHT;
 		countdown_layer_onscreen = false;
+		wake_countdown();
 		animate_code_off();
 		animate_label_off();
 		break;
@@ -214,8 +227,9 @@ void animation_control(void) {
 }
 
 void single_code_window_second_tick(int seconds) {
+	wake_countdown();
 
-	if (seconds % 30 == 0)
+	if (getOtpTime(timezone_offset) % selected_period() == 0)
 		otp_update_tick++;
 
 	if	(otp_updated_at_tick != otp_update_tick) {
@@ -234,6 +248,8 @@ void single_code_window_second_tick(int seconds) {
 		else
 			refresh_screen_data(DOWN);	
 	}
+	else if (otp_updated_at_tick == otp_update_tick) // Not while a new code animates on
+		code_cache_prefetch();
 }
 
 void up_single_click_handler(ClickRecognizerRef recognizer, void *context) {
@@ -286,43 +302,12 @@ void apply_display_colors() {
 }
 
 void set_fonts(void) {
-	if (font_label.isCustom)
-		fonts_unload_custom_font(font_label.font);
-
-	if (font_pin.isCustom)
-		fonts_unload_custom_font(font_pin.font);
-
-	switch(font)
-	{
-		case 1 :
-		font_label.font = fonts_get_system_font(FONT_KEY_GOTHIC_24);
-		font_label.isCustom = false;
-		font_pin.font = fonts_get_system_font(FONT_KEY_BITHAM_34_MEDIUM_NUMBERS);
-		font_pin.isCustom = false;
-		break;
-		case 2 :
-		font_label.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_DIGITAL_30));
-		font_label.isCustom = true;
-		font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_DIGITAL_42));
-		font_pin.isCustom = true;
-		break;
-		case 3 :
-		font_label.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_BD_CARTOON_20));
-		font_label.isCustom = true;
-		font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_BD_CARTOON_30));
-		font_pin.isCustom = true;
-		break;
-		default :
+	if (font >= FONT_COUNT)
 		font = 0;
-		font_label.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ORBITRON_28));
-		font_label.isCustom = true;
-		font_pin.font = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_BITWISE_32));
-		font_pin.isCustom = true;
-		break;
-	}
+
 	set_textlayer_positions(font, &text_label_rect, &text_pin_rect);
-	text_layer_set_font(text_label_layer, font_label.font);
-	text_layer_set_font(text_pin_layer, font_pin.font);
+	text_layer_set_font(text_label_layer, font_manager_label(font));
+	text_layer_set_font(text_pin_layer, font_manager_code(font, pin_text));
 	fonts_changed = false;
 }
 
@@ -346,7 +331,7 @@ static void single_code_window_load(Window *window) {
 	text_layer_set_text(text_pin_layer, pin_text);
 	layer_add_child(window_layer, text_layer_get_layer(text_pin_layer));
 
-	single_code_graphics_layer = layer_create(display_bounds);
+	single_code_graphics_layer = layer_create(countdown_graphic_frame(display_bounds));
 	layer_set_update_proc(single_code_graphics_layer, update_graphics);
 	layer_add_child(window_layer, single_code_graphics_layer);
 
@@ -365,7 +350,9 @@ static void single_code_window_appear(Window *window) {
 
 void single_code_window_unload(Window *window) {
 	single_code_exiting = true;
-	app_timer_cancel(single_code_graphics_timer);
+	if (single_code_graphics_timer)
+		app_timer_cancel(single_code_graphics_timer);
+	single_code_graphics_timer = NULL;
 	text_layer_destroy(text_label_layer);
 	text_layer_destroy(text_pin_layer);
 	layer_destroy(single_code_graphics_layer);
@@ -2,10 +2,25 @@ var Clay = require('pebble-clay');
 var clayConfig = require('./config');
 var clay = new Clay(clayConfig, null, { autoHandleEvents: false });
 
-var MAX_OTP_COUNT = 30;
+var MAX_OTP_COUNT = 100; // MAX_OTP on the watch
+var MAX_BATCH_KEYS = 30; // Size of the transmit_keys array in package.json
 var MAX_LABEL_LENGTH = 20;
 var MAX_KEY_LENGTH = 128;
+var MAX_SECRET_LENGTH = 80;
+var KEY_RECORD_HEADER_LENGTH = 5;
+var OTP_ALGORITHM_SHA1 = 0;
+var OTP_ALGORITHMS = ["SHA1", "SHA256", "SHA512"]; // Indexed by the watch's OTP_ALGORITHM_*
+var OTP_DEFAULT_DIGITS = 6;
+var OTP_MIN_DIGITS = 6;
+var OTP_MAX_DIGITS = 10;
+var OTP_DEFAULT_PERIOD = 30;
+var OTP_MAX_PERIOD = 255;
 var MAX_MESSAGE_RETRIES = 5;
+var MESSAGE_RETRY_DELAY = 100; // ms, doubled after each failed attempt
+var DEFAULT_INBOX_SIZE = 750;
+var DICT_HEADER_SIZE = 1;
+var TUPLE_HEADER_SIZE = 7;
+var INT_TUPLE_SIZE = TUPLE_HEADER_SIZE + 4;
 var APP_VERSION = 33;
 
 var otp_count = 0;
@@ -15,10 +30,286 @@ var font = 0;
 var timezone_offset = 0;
 var idle_timeout = 0;
 var window_layout = -1;
-var message_send_retries = 0;
-var msg_data;
+var message_queue = [];
+var message_in_flight = false;
 var debug = false;
 var keys = require('message_keys');
+var pending_keys = [];
+var pending_deletes = [];
+var secret_index = Object.create(null); // Position of each key by its decoded secret
+var rejected_keys = {}; // Digest of the copy the watch kept by the digest it had no room for, 0 for none
+var BASE32_ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+// Decodes base32 the same way the watch does, returning an array of bytes
+// or null if the text contains characters the watch would reject.
+function base32Decode(text) {
+	var bytes = [];
+	var buffer = 0;
+	var bitsLeft = 0;
+	for (var i = 0; i < text.length; i++) {
+		var ch = text.charAt(i).toUpperCase();
+		if (" \t\r\n-".indexOf(ch) != -1)
+			continue;
+
+		// Deal with commonly mistyped characters
+		if (ch == "0")
+			ch = "O";
+		else if (ch == "1")
+			ch = "L";
+		else if (ch == "8")
+			ch = "B";
+
+		var value = BASE32_ALPHABET.indexOf(ch);
+		if (value == -1)
+			return null;
+
+		buffer = ((buffer << 5) | value) & 0xFFFF;
+		bitsLeft += 5;
+		if (bitsLeft >= 8) {
+			bytes.push((buffer >> (bitsLeft - 8)) & 0xFF);
+			bitsLeft -= 8;
+		}
+	}
+	return bytes;
+}
+
+function base32Encode(bytes) {
+	var text = "";
+	var buffer = 0;
+	var bitsLeft = 0;
+	for (var i = 0; i < bytes.length; i++) {
+		buffer = ((buffer << 8) | bytes[i]) & 0xFFFF;
+		bitsLeft += 8;
+		while (bitsLeft >= 5) {
+			text += BASE32_ALPHABET.charAt((buffer >> (bitsLeft - 5)) & 0x1F);
+			bitsLeft -= 5;
+		}
+	}
+	if (bitsLeft > 0)
+		text += BASE32_ALPHABET.charAt((buffer << (5 - bitsLeft)) & 0x1F);
+	return text;
+}
+
+// The watch stores keys in binary and re-encodes them when talking to the
+// phone, so keys are compared on their decoded form.
+function canonicalSecret(secret) {
+	var bytes = base32Decode(secret);
+	return bytes === null ? secret : base32Encode(bytes);
+}
+
+// Looks a key up by its decoded secret, so "ABC" cannot match a saved
+// "XABCY" and spacing or case make no difference. Returns -1 if not found.
+function findKey(secret) {
+	var position = secret_index[canonicalSecret(secret)];
+	return position === undefined ? -1 : position;
+}
+
+// Keys are saved as "label:key", followed by "?algorithm=SHA256&digits=8"
+// and so on for any options that are not the defaults
+function getSecretFromPair(secretPair) {
+	var secret = secretPair.substring(secretPair.indexOf(":")+1);
+	var optionsStart = secret.indexOf("?");
+	return optionsStart == -1 ? secret : secret.substring(0, optionsStart);
+}
+
+// Reads options in otpauth:// parameter form. Returns null if any are out of
+// the range the watch supports.
+function parseOptions(query) {
+	var options = { algorithm: OTP_ALGORITHM_SHA1, digits: OTP_DEFAULT_DIGITS, period: OTP_DEFAULT_PERIOD };
+	var params = query ? query.split("&") : [];
+	for (var i = 0; i < params.length; i++) {
+		var name = params[i].split("=")[0].toLowerCase();
+		var value = params[i].substring(name.length+1);
+		if (name == "algorithm") {
+			options.algorithm = OTP_ALGORITHMS.indexOf(value.toUpperCase());
+			if (options.algorithm == -1)
+				return null;
+		} else if (name == "digits") {
+			options.digits = parseInt(value, 10);
+			if (!(options.digits >= OTP_MIN_DIGITS && options.digits <= OTP_MAX_DIGITS))
+				return null;
+		} else if (name == "period") {
+			options.period = parseInt(value, 10);
+			if (!(options.period >= 1 && options.period <= OTP_MAX_PERIOD))
+				return null;
+		}
+	}
+	return options;
+}
+
+function getOptionsFromPair(secretPair) {
+	var optionsStart = secretPair.indexOf("?", secretPair.indexOf(":"));
+	return parseOptions(optionsStart == -1 ? "" : secretPair.substring(optionsStart+1));
+}
+
+function formatOptions(options) {
+	var params = [];
+	if (options.algorithm != OTP_ALGORITHM_SHA1)
+		params.push("algorithm="+OTP_ALGORITHMS[options.algorithm]);
+	if (options.digits != OTP_DEFAULT_DIGITS)
+		params.push("digits="+options.digits);
+	if (options.period != OTP_DEFAULT_PERIOD)
+		params.push("period="+options.period);
+	return params.length > 0 ? "?"+params.join("&") : "";
+}
+
+// Splits an otpauth://totp/ link into its label, secret and options. Returns
+// null for anything else, including HOTP links as the watch has no counter.
+function parseOtpauth(uri) {
+	var match = /^otpauth:\/\/totp\/([^?]*)\?(.*)$/i.exec(uri.trim());
+	if (!match)
+		return null;
+
+	try {
+		var query = decodeURIComponent(match[2]);
+		var options = parseOptions(query.replace(/(^|&)(secret|issuer)=[^&]*/gi, ""));
+		var secret = /(?:^|&)secret=([^&]*)/i.exec(query);
+		var issuer = /(?:^|&)issuer=([^&]*)/i.exec(query);
+		if (options === null || !secret)
+			return null;
+
+		// "Issuer:account" labels are cut to the issuer, it is what fits on the watch
+		var label = decodeURIComponent(match[1]);
+		if (issuer)
+			label = issuer[1];
+		else if (label.indexOf(":") > 0)
+			label = label.substring(0, label.indexOf(":"));
+
+		return { label: label, secret: secret[1], options: options };
+	} catch (err) {
+		return null;
+	}
+}
+
+// UTF-8 bytes of the label, cut back to whole characters that fit the watch
+function labelBytes(secretPair) {
+	var label = secretPair.substring(0, secretPair.indexOf(":"));
+	var bytes = unescape(encodeURIComponent(label));
+	while (bytes.length > MAX_LABEL_LENGTH) {
+		label = label.substring(0, label.length-1);
+		var last = label.charCodeAt(label.length-1);
+		if (last >= 0xD800 && last <= 0xDBFF)
+			label = label.substring(0, label.length-1);
+		bytes = unescape(encodeURIComponent(label));
+	}
+	return bytes;
+}
+
+// Packs a "label:key" pair into the record layout the watch keeps in its key
+// store, see key_store.h. Returns null for keys the watch would reject.
+function packRecord(secretPair) {
+	var label = labelBytes(secretPair);
+	var secret = base32Decode(getSecretFromPair(secretPair));
+	var options = getOptionsFromPair(secretPair);
+	if (secret === null || secret.length < 1 || secret.length > MAX_SECRET_LENGTH || options === null)
+		return null;
+
+	var record = [label.length, secret.length, options.algorithm, options.digits, options.period];
+	for (var i = 0; i < label.length; i++)
+		record.push(label.charCodeAt(i));
+	return record.concat(secret);
+}
+
+// Same FNV-1a digest the watch keeps for each key, over the UTF-8 label, a
+// zero byte, the decoded secret and the algorithm, digits and period bytes.
+// Returns null for keys the watch would reject.
+function recordDigest(secretPair) {
+	var record = packRecord(secretPair);
+	if (record === null)
+		return null;
+
+	var secretStart = KEY_RECORD_HEADER_LENGTH + record[0];
+	var digest = 0x811C9DC5;
+	for (var i = KEY_RECORD_HEADER_LENGTH; i < secretStart; i++)
+		digest = Math.imul(digest ^ record[i], 0x01000193);
+	digest = Math.imul(digest, 0x01000193);
+	for (var j = secretStart; j < record.length; j++)
+		digest = Math.imul(digest ^ record[j], 0x01000193);
+	for (var k = 2; k < KEY_RECORD_HEADER_LENGTH; k++)
+		digest = Math.imul(digest ^ record[k], 0x01000193);
+
+	return digest >>> 0;
+}
+
+// The keys the watch can hold, as { pair, digest } in phone order. Keys it
+// would reject are left out, and of keys sharing a secret only the last is
+// kept, as the watch relabels the first with it. A key the watch had no room
+// for counts as the copy it kept, if any, until a delete frees some room.
+function watchKeys() {
+	var last = Object.create(null);
+	var valid = [];
+	for (var i = 0; i < otp_count; i++) {
+		var secretPair = getItem("secret_pair"+i);
+		var digest = recordDigest(secretPair);
+		if (digest !== null && digest in rejected_keys)
+			digest = rejected_keys[digest] || null;
+		if (digest === null)
+			continue;
+
+		last[canonicalSecret(getSecretFromPair(secretPair))] = valid.length;
+		valid.push({ pair: secretPair, digest: digest });
+	}
+
+	var kept = [];
+	for (var j = 0; j < valid.length; j++) {
+		if (last[canonicalSecret(getSecretFromPair(valid[j].pair))] == j)
+			kept.push(valid[j]);
+	}
+	return kept;
+}
+
+// Order independent, matching the watch, so reordering keys there does not
+// cause a sync
+function tableDigest() {
+	var kept = watchKeys();
+	var digest = 0;
+	for (var i = 0; i < kept.length; i++)
+		digest = (digest + kept[i].digest) >>> 0;
+	return (digest + kept.length) >>> 0;
+}
+
+function unpackDigests(bytes) {
+	var digests = [];
+	for (var i = 0; i + 4 <= bytes.length; i += 4)
+		digests.push((bytes[i] | bytes[i+1] << 8 | bytes[i+2] << 16 | bytes[i+3] << 24) >>> 0);
+	return digests;
+}
+
+function packDigests(digests) {
+	var bytes = [];
+	for (var i = 0; i < digests.length; i++)
+		bytes.push(digests[i] & 0xFF, (digests[i] >>> 8) & 0xFF, (digests[i] >>> 16) & 0xFF, digests[i] >>> 24);
+	return bytes;
+}
+
+// Works out which keys the watch is missing or has an old label for, and
+// which watch keys are no longer on the phone. Without watch digests every
+// key is sent.
+function comparePendingKeys(watchDigests) {
+	var kept = watchKeys();
+	var phoneDigests = [];
+	pending_keys = [];
+	pending_deletes = [];
+
+	for (var i = 0; i < kept.length; i++) {
+		phoneDigests.push(kept[i].digest);
+		if (!watchDigests || watchDigests.indexOf(kept[i].digest) == -1)
+			pending_keys.push(packRecord(kept[i].pair));
+	}
+
+	// An empty phone is more likely lost storage than a wish to wipe the watch.
+	// Nothing is deleted while the watch is full either, as a key it could
+	// not relabel is still there under its old digest.
+	if (watchDigests && phoneDigests.length > 0 && Object.keys(rejected_keys).length === 0) {
+		for (var j = 0; j < watchDigests.length; j++) {
+			if (phoneDigests.indexOf(watchDigests[j]) == -1)
+				pending_deletes.push(watchDigests[j]);
+		}
+	}
+
+	if (debug)
+		console.log("INFO: "+pending_keys.length+" keys to send, "+pending_deletes.length+" to delete");
+}
 
 function checkKeyStringIsValid(key) {
 	if (debug)
@@ -80,22 +371,48 @@ function getWatchVersion() {
 }
 
 function UpdateClayData() {
+	var rejected = Object.keys(rejected_keys).length;
 	clay.setSettings("auth_name", "");
 	clay.setSettings("auth_key", "");
-	clay.setSettings("slots_remaining", "You have "+(MAX_OTP_COUNT-otp_count)+" slots remaining");
+	if (rejected > 0)
+		clay.setSettings("slots_remaining", "The watch is full, "+rejected+" keys could not be saved on it");
+	else
+		clay.setSettings("slots_remaining", "You have "+(MAX_OTP_COUNT-otp_count)+" slots remaining");
+}
+
+// The watch lists keys it had no room for as pairs of digests, the key sent
+// and the copy it kept
+function rejectKeys(bytes) {
+	var digests = unpackDigests(bytes);
+	for (var i = 0; i + 1 < digests.length; i += 2)
+		rejected_keys[digests[i]] = digests[i+1];
+	setItem("rejected_keys", JSON.stringify(rejected_keys));
+	UpdateClayData();
+
+	if (debug)
+		console.log("WARN: The watch is full, "+Object.keys(rejected_keys).length+" keys not saved");
 }
 
 function loadLocalVariables() {
 	otp_count = 0;
+	secret_index = Object.create(null);
 	for (var i=0; i<MAX_OTP_COUNT; i++)
 	{
 		var tempKey = getItem("secret_pair"+i);
-		if (checkKeyStringIsValid(tempKey))
+		if (checkKeyStringIsValid(tempKey)) {
+			secret_index[canonicalSecret(getSecretFromPair(tempKey))] = i;
 			otp_count++;
+		}
 		else
 			break;
 	}
 
+	try {
+		rejected_keys = JSON.parse(getItem("rejected_keys")) || {};
+	} catch (err) {
+		rejected_keys = {};
+	}
+
 	foreground_color = parseInt(getItem("foreground_color"));
 	background_color = parseInt(getItem("background_color"));
 	font = parseInt(getItem("font"));
@@ -126,18 +443,61 @@ function setItem(reference, item) {
 	localStorage.setItem(reference ,item);
 }
 
+// Settings are resent whole each time, so a newer update can be folded into
+// one still waiting to go out
+function isSettingsMessage(data) {
+	var settingsKeys = [keys.timezone, keys.font, keys.idle_timeout, keys.window_layout,
+		keys.foreground_color, keys.background_color];
+	for (var key in data) {
+		if (settingsKeys.indexOf(parseInt(key)) == -1)
+			return false;
+	}
+	return true;
+}
+
+// Messages go out one at a time as the watch can only take one into its
+// inbox at once. A failed message is retried with a growing delay before
+// moving on to the next.
 function sendAppMessage(data) {
-	msg_data = data;
-	Pebble.sendAppMessage(data, function(e) { // SUCCESS
+	var last = message_queue[message_queue.length-1];
+	var lastWaiting = last && (message_queue.length > 1 || !message_in_flight);
+
+	if (lastWaiting && isSettingsMessage(last.data) && isSettingsMessage(data)) {
+		for (var key in data)
+			last.data[key] = data[key];
+		return;
+	}
+
+	message_queue.push({ data: data, retries: 0 });
+	sendNextMessage();
+}
+
+function sendNextMessage() {
+	if (message_in_flight || message_queue.length === 0)
+		return;
+
+	var message = message_queue[0];
+	message_in_flight = true;
+	Pebble.sendAppMessage(message.data, function(e) { // SUCCESS
 		if (debug)
 			console.log("INFO: Successfully delivered message with transactionId=" + e.data.transactionId);
-		message_send_retries = 0;
+		message_queue.shift();
+		message_in_flight = false;
+		sendNextMessage();
 	}, function(e) { // FAILURE
 		if (debug)
 			console.log("ERROR: Unable to deliver message with transactionId=" + e.data.transactionId);// + " Error is: " + e.error.message);
-		if (message_send_retries <= MAX_MESSAGE_RETRIES) {
-			message_send_retries++;
-			sendAppMessage(msg_data);
+		if (message.retries < MAX_MESSAGE_RETRIES) {
+			var delay = MESSAGE_RETRY_DELAY << message.retries;
+			message.retries++;
+			setTimeout(function() {
+				message_in_flight = false;
+				sendNextMessage();
+			}, delay);
+		} else {
+			message_queue.shift();
+			message_in_flight = false;
+			sendNextMessage();
 		}
 	});
 }
@@ -156,6 +516,7 @@ Pebble.addEventListener("ready", function(e) {
 	// Send timezone, keycount, and colors to watch
 	var dict = {};
 	dict[keys.key_count] = otp_count;
+	dict[keys.table_digest] = tableDigest() | 0;
 	if (foreground_color >= 0 && background_color >= 0) {
 		dict[keys.foreground_color] = foreground_color;
 		dict[keys.background_color] = background_color;
@@ -191,31 +552,66 @@ Pebble.addEventListener("ready", function(e) {
 }
 );
 
-function sendKeyToWatch(secret) {
+// Sends pending keys first_key onwards (1 based) in as few messages as the
+// watch inbox allows. Each batch carries the number of its first key so the
+// watch can spot a lost or repeated batch. The last one is marked and lists
+// the digests of keys the watch should delete.
+function sendKeysToWatch(first_key, inbox_size) {
 	var dict = {};
-	dict[keys.transmit_key] = secret;
+	var size = DICT_HEADER_SIZE + INT_TUPLE_SIZE * 2;
+	var count = 0;
+	var i = first_key - 1;
+
+	if (pending_deletes.length > 0)
+		size += TUPLE_HEADER_SIZE + pending_deletes.length * 4;
+
+	dict[keys.sync_sequence] = first_key;
+	for (; i < pending_keys.length; i++) {
+		var tupleSize = TUPLE_HEADER_SIZE + pending_keys[i].length;
+		if (count >= MAX_BATCH_KEYS || (count > 0 && size + tupleSize > inbox_size))
+			break;
+
+		dict[keys.transmit_keys + count] = pending_keys[i];
+		size += tupleSize;
+		count++;
+	}
+
+	if (i >= pending_keys.length) {
+		dict[keys.sync_end] = 1;
+		if (pending_deletes.length > 0)
+			dict[keys.delete_digests] = packDigests(pending_deletes);
+	}
+
+	if (debug)
+		console.log("INFO: Sending "+count+" keys from "+first_key+" in "+size+" bytes");
+
 	sendAppMessage(dict);
 }
 
 function confirmDelete(secret) {
-	var blnFound = false;
-	for (var i = 0; i < MAX_OTP_COUNT;i++) {
-		var savedSecret = getItem('secret_pair'+i);
-
-		if (savedSecret !== null && savedSecret.indexOf(secret) != -1)
-			blnFound = true;
-
-		if (blnFound) {
+	var position = findKey(secret);
+	if (position != -1) {
+		for (var i = position; i < MAX_OTP_COUNT;i++) {
 			var nextSecret = getItem('secret_pair'+(i+1));
 			if (nextSecret)
 				setItem('secret_pair'+i,nextSecret);
 			else
 				localStorage.removeItem('secret_pair'+i);
 		}
-	}
-	if (blnFound)
 		otp_count--;
 
+		delete secret_index[canonicalSecret(secret)];
+		for (var indexed in secret_index) {
+			if (secret_index[indexed] > position)
+				secret_index[indexed]--;
+		}
+	}
+
+	// The watch has room again, so keys it turned away are tried next sync
+	rejected_keys = {};
+	localStorage.removeItem("rejected_keys");
+	UpdateClayData();
+
 	var dict = {};
 	dict[keys.delete_key] = secret;
 	sendAppMessage(dict);
@@ -225,21 +621,22 @@ function confirmDelete(secret) {
 Pebble.addEventListener("appmessage", function(e) {
 	if (debug)
 		console.log("INFO: Message Recieved");
+	if (e.payload.rejected_keys)
+		rejectKeys(e.payload.rejected_keys);
+
 	if (e.payload.request_key) {
 		if (debug)
-			console.log("INFO: Requested key: "+e.payload.request_key);
-		var requested_key = getItem("secret_pair"+(e.payload.request_key-1));
-		if (checkKeyStringIsValid(requested_key))
-			sendKeyToWatch(requested_key);
-		else
-			sendKeyToWatch("NULL"+e.payload.request_key);
+			console.log("INFO: Requested keys from: "+e.payload.request_key);
+		if (e.payload.request_key == 1)
+			comparePendingKeys(e.payload.record_digests ? unpackDigests(e.payload.record_digests) : null);
+		sendKeysToWatch(e.payload.request_key, e.payload.sync_inbox_size || DEFAULT_INBOX_SIZE);
 	}
 	else if (e.payload.delete_key) {
 		if (debug)
 			console.log("INFO: Deleting key: "+e.payload.delete_key);
 		confirmDelete(e.payload.delete_key);
 	}
-	else {
+	else if (!e.payload.rejected_keys) {
 		if (debug)
 			console.log("INFO: Unknown payload:"+e.payload);
 	}
@@ -264,7 +661,6 @@ Pebble.addEventListener('webviewclosed', function(e) {
 	}
 	var configuration = clay.getSettings(e.response);
 	var config = {};
-	var i = 0;
 
 	if (!isNaN(configuration[keys.foreground_color]) && configuration[keys.foreground_color] !== foreground_color) {
 		foreground_color = configuration[keys.foreground_color];
@@ -318,9 +714,21 @@ Pebble.addEventListener('webviewclosed', function(e) {
 	// it was disabled while configuring
 	config[keys.idle_timeout] = idle_timeout;
 
-	if(configuration[keys.auth_name] && configuration[keys.auth_key]) {
+	// The key can also be an otpauth:// link, which brings its own label and
+	// options. A link the watch cannot follow is not added at all.
+	var link = null;
+	if (configuration[keys.auth_key] && /^\s*otpauth:/i.test(configuration[keys.auth_key])) {
+		link = parseOtpauth(configuration[keys.auth_key]);
+		if (link === null && debug)
+			console.log("WARN: Unsupported otpauth link");
+		if (link !== null && !configuration[keys.auth_name])
+			configuration[keys.auth_name] = link.label;
+	}
+
+	if(configuration[keys.auth_name] && configuration[keys.auth_key] &&
+	   (link !== null || !/^\s*otpauth:/i.test(configuration[keys.auth_key]))) {
 
-		var secret = configuration[keys.auth_key]
+		var secret = (link ? link.secret : configuration[keys.auth_key])
 		.replace(/0/g,"O")	// replace 0 with O
 		.replace(/1/g, "I")	// replace 1 with I
 		.replace(/\W/g, '')	// replace non-alphanumeric characters
@@ -330,29 +738,30 @@ Pebble.addEventListener('webviewclosed', function(e) {
 		var label = configuration[keys.auth_name]
 		.replace(/:/g, '')
 		.substring(0, MAX_LABEL_LENGTH);
-		var secretPair = label + ":" + secret;
+		var secretPair = label + ":" + secret + formatOptions(link ? link.options : parseOptions(""));
 
 		var valid_key = checkKeyStringIsValid(secretPair);
+		var record = packRecord(secretPair);
+
+		var position = findKey(secret);
+		var blnKeyExists = position != -1;
+		if (blnKeyExists) {
+			if (debug)
+				console.log("INFO: Relabled code");
 
-		var blnKeyExists = false;
-		for (i=0;i<otp_count;i++) {
-			var savedSecret = getItem('secret_pair'+i);
-			if (savedSecret !== null && savedSecret.indexOf(secret) != -1) {
-				if (debug)
-					console.log("INFO: Relabled code");
-
-				blnKeyExists = true;
-				setItem('secret_pair'+i,secretPair);
-				config[keys.transmit_key] = secretPair;
-			}
+			setItem('secret_pair'+position,secretPair);
+			if (record)
+				config[keys.transmit_record] = record;
 		}
 		if(valid_key && !blnKeyExists && otp_count < MAX_OTP_COUNT) {
 			if (debug)
 				console.log("INFO: Uploading new key:"+secretPair);
 
 			setItem('secret_pair'+otp_count,secretPair);
+			secret_index[canonicalSecret(secret)] = otp_count;
 			otp_count++;
-			config[keys.transmit_key] = secretPair;
+			if (record)
+				config[keys.transmit_record] = record;
 		}
 		else if (blnKeyExists) {
 			if (debug)
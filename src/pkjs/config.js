@@ -32,8 +32,9 @@ module.exports =
 				"type": "input",
 				"messageKey": "auth_key",
 				"label": "Key",
+				"description": "The secret, or an otpauth:// link which also sets the name, digits, period and algorithm",
 				"attributes": {
-					"limit": 128
+					"limit": 512
 				}
 			},
 			{ 
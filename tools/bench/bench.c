@@ -0,0 +1,196 @@
+//
+// Micro-benchmarks for the crypto core (sha1, hmac, base32 and code
+// generation). Reports nanoseconds and, where available, CPU cycles per
+// operation so changes to these files can be compared against a baseline.
+//
+
+#include <stdlib.h>
+#include "pebble.h"
+#include "sha1.h"
+#include "hmac.h"
+#include "base32.h"
+#include "google-authenticator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+static inline uint64_t read_cycles(void) { return __rdtsc(); }
+#else
+#define HAVE_CYCLES 0
+static inline uint64_t read_cycles(void) { return 0; }
+#endif
+
+#define MAX_KEY_LENGTH 128 // base32 characters, matches main.h less termination
+#define MIN_RUN_NS 200000000ULL
+
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef void (*BenchFn)(void *arg);
+
+// Run fn in growing batches until at least MIN_RUN_NS has elapsed.
+static void bench(const char *name, BenchFn fn, void *arg) {
+  unsigned long iterations = 16;
+  uint64_t elapsed, cycles;
+
+  for (;;) {
+    uint64_t start = now_ns();
+    uint64_t start_cycles = read_cycles();
+    for (unsigned long i = 0; i < iterations; i++)
+      fn(arg);
+    cycles = read_cycles() - start_cycles;
+    elapsed = now_ns() - start;
+    if (elapsed >= MIN_RUN_NS)
+      break;
+    iterations *= 2;
+  }
+
+  double ns = (double)elapsed / iterations;
+  if (HAVE_CYCLES)
+    printf("%-36s %12.1f ns/op %12.1f cycles/op\n", name, ns, (double)cycles / iterations);
+  else
+    printf("%-36s %12.1f ns/op %12s cycles/op\n", name, ns, "n/a");
+}
+
+static uint8_t data[4096];
+static char encoded[MAX_KEY_LENGTH + 1];
+
+struct sha1_arg { int length; };
+
+static void run_sha1(void *arg) {
+  struct sha1_arg *a = arg;
+  SHA1_INFO ctx;
+  uint8_t digest[SHA1_DIGEST_LENGTH];
+  sha1_init(&ctx);
+  sha1_update(&ctx, data, a->length);
+  sha1_final(&ctx, digest);
+  sink += digest[0];
+}
+
+struct hmac_arg { int key_length; HMAC_SHA1_KEY key; };
+
+static void run_hmac(void *arg) {
+  struct hmac_arg *a = arg;
+  uint8_t result[SHA1_DIGEST_LENGTH];
+  hmac_sha1(data, a->key_length, data + 128, 8, result, sizeof(result));
+  sink += result[0];
+}
+
+static void run_hmac_with_key(void *arg) {
+  struct hmac_arg *a = arg;
+  uint8_t result[SHA1_DIGEST_LENGTH];
+  hmac_sha1_with_key(&a->key, data + 128, 8, result, sizeof(result));
+  sink += result[0];
+}
+
+struct base32_arg { int length; };
+
+static void run_base32_decode(void *arg) {
+  struct base32_arg *a = arg;
+  uint8_t result[MAX_KEY_LENGTH];
+  char saved = encoded[a->length];
+  encoded[a->length] = '\0';
+  sink += base32_decode((const uint8_t *)encoded, result, sizeof(result));
+  encoded[a->length] = saved;
+}
+
+static void run_prepare_key(void *arg) {
+  struct base32_arg *a = arg;
+  OtpKey key;
+  char saved = encoded[a->length];
+  encoded[a->length] = '\0';
+  sink += prepareKey(encoded, &key);
+  encoded[a->length] = saved;
+}
+
+static void run_generate_code_at(void *arg) {
+  OtpKey *key = arg;
+  char code[VERIFICATION_CODE_LENGTH];
+  generateCodeAt(key, 1111111109, code, sizeof(code));
+  sink += code[0];
+}
+
+#define BATCH_KEYS 4 // KEY_PAGE_SIZE in key_store.h
+
+static OtpKey batch_keys[BATCH_KEYS];
+
+static void run_generate_codes_single(void *arg) {
+  char code[VERIFICATION_CODE_LENGTH];
+  for (int i = 0; i < BATCH_KEYS; i++) {
+    generateCodeAt(&batch_keys[i], 1111111109, code, sizeof(code));
+    sink += code[0];
+  }
+}
+
+static void run_generate_codes_batch(void *arg) {
+  char codes[BATCH_KEYS][VERIFICATION_CODE_LENGTH];
+  sink += generate_codes_batch(batch_keys, BATCH_KEYS, 1111111109, codes);
+}
+
+int main(void) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+  static const int sha1_lengths[] = { 8, 20, 64, 1024, 4096 };
+  static const int key_lengths[] = { 16, 32, 64, MAX_KEY_LENGTH };
+  char name[64];
+
+  srand(1);
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = rand();
+  for (int i = 0; i < MAX_KEY_LENGTH; i++)
+    encoded[i] = alphabet[rand() % 32];
+  encoded[MAX_KEY_LENGTH] = '\0';
+
+  for (size_t i = 0; i < sizeof(sha1_lengths) / sizeof(sha1_lengths[0]); i++) {
+    struct sha1_arg arg = { sha1_lengths[i] };
+    snprintf(name, sizeof(name), "sha1 %d bytes", arg.length);
+    bench(name, run_sha1, &arg);
+  }
+
+  for (size_t i = 0; i < sizeof(key_lengths) / sizeof(key_lengths[0]); i++) {
+    // Decoded secret length for a base32 key of this many characters
+    struct hmac_arg arg = { key_lengths[i] * BITS_PER_BASE32_CHAR / 8 };
+    hmac_sha1_init_key(&arg.key, data, arg.key_length);
+    snprintf(name, sizeof(name), "hmac_sha1 key %d bytes", arg.key_length);
+    bench(name, run_hmac, &arg);
+    snprintf(name, sizeof(name), "hmac_sha1_with_key key %d bytes", arg.key_length);
+    bench(name, run_hmac_with_key, &arg);
+  }
+
+  for (size_t i = 0; i < sizeof(key_lengths) / sizeof(key_lengths[0]); i++) {
+    struct base32_arg arg = { key_lengths[i] };
+    snprintf(name, sizeof(name), "base32_decode %d chars", arg.length);
+    bench(name, run_base32_decode, &arg);
+  }
+
+  for (size_t i = 0; i < sizeof(key_lengths) / sizeof(key_lengths[0]); i++) {
+    struct base32_arg arg = { key_lengths[i] };
+    snprintf(name, sizeof(name), "prepareKey %d chars", arg.length);
+    bench(name, run_prepare_key, &arg);
+
+    OtpKey key;
+    char saved = encoded[arg.length];
+    encoded[arg.length] = '\0';
+    prepareKey(encoded, &key);
+    encoded[arg.length] = saved;
+    snprintf(name, sizeof(name), "generateCodeAt %d chars", arg.length);
+    bench(name, run_generate_code_at, &key);
+  }
+
+  for (int i = 0; i < BATCH_KEYS; i++) {
+    char saved = encoded[16 + i];
+    encoded[16 + i] = '\0';
+    prepareKey(encoded + i, &batch_keys[i]);
+    encoded[16 + i] = saved;
+  }
+  snprintf(name, sizeof(name), "generateCodeAt x%d", BATCH_KEYS);
+  bench(name, run_generate_codes_single, NULL);
+  snprintf(name, sizeof(name), "generate_codes_batch x%d", BATCH_KEYS);
+  bench(name, run_generate_codes_batch, NULL);
+
+  return 0;
+}
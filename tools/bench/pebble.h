@@ -0,0 +1,20 @@
+//
+// Minimal pebble.h stand-in so the crypto sources in src/c can be built and
+// benchmarked on a host machine. Only what those files use is provided.
+//
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define APP_LOG_LEVEL_ERROR 1
+#define APP_LOG_LEVEL_WARNING 50
+#define APP_LOG_LEVEL_INFO 100
+#define APP_LOG_LEVEL_DEBUG 200
+
+#define APP_LOG(level, fmt, args...) \
+  do { if (0) printf(fmt, ## args); } while (0)
@@ -0,0 +1,386 @@
+//
+// Host implementation of the parts of the Pebble SDK declared in pebble.h.
+// Persistent storage is kept in a file so it survives between launches, and
+// AppMessage traffic is handed to the driver in sim_watch.c.
+//
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include "pebble.h"
+#include "fake_pebble.h"
+
+uint32_t sim_now_ms;
+bool sim_verbose;
+
+void app_log(uint8_t level, const char *filename, int line, const char *fmt, ...) {
+  if (!sim_verbose && level != APP_LOG_LEVEL_ERROR)
+    return;
+
+  va_list args;
+  va_start(args, fmt);
+  printf("log %s:%d ", filename, line);
+  vprintf(fmt, args);
+  printf("\n");
+  va_end(args);
+}
+
+// Storage
+
+#define PERSIST_KEYS 256
+#define PERSIST_BUDGET 4096 // Bytes an app may keep on the watch
+
+typedef struct {
+  bool used;
+  uint16_t length;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistSlot;
+
+static PersistSlot persist[PERSIST_KEYS];
+static const char *persist_path;
+
+void sim_persist_open(const char *path) {
+  persist_path = path;
+  memset(persist, 0, sizeof(persist));
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return;
+  if (fread(persist, sizeof(persist), 1, file) != 1)
+    memset(persist, 0, sizeof(persist));
+  fclose(file);
+}
+
+static void persist_save(void) {
+  if (persist_path == NULL)
+    return;
+
+  FILE *file = fopen(persist_path, "wb");
+  if (file == NULL)
+    return;
+  fwrite(persist, sizeof(persist), 1, file);
+  fclose(file);
+}
+
+static PersistSlot *persist_slot(uint32_t key) {
+  return key < PERSIST_KEYS ? &persist[key] : NULL;
+}
+
+bool persist_exists(uint32_t key) {
+  PersistSlot *slot = persist_slot(key);
+  return slot != NULL && slot->used;
+}
+
+int persist_read_data(uint32_t key, void *buffer, size_t buffer_size) {
+  PersistSlot *slot = persist_slot(key);
+  if (slot == NULL || !slot->used)
+    return E_DOES_NOT_EXIST;
+
+  size_t length = slot->length < buffer_size ? slot->length : buffer_size;
+  memcpy(buffer, slot->data, length);
+  return length;
+}
+
+int32_t persist_read_int(uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+int persist_read_string(uint32_t key, char *buffer, size_t buffer_size) {
+  int length = persist_read_data(key, buffer, buffer_size);
+  if (length > 0)
+    buffer[length < (int)buffer_size ? length : (int)buffer_size - 1] = '\0';
+  return length;
+}
+
+int persist_write_data(uint32_t key, const void *data, size_t size) {
+  PersistSlot *slot = persist_slot(key);
+  if (slot == NULL)
+    return E_ERROR;
+
+  if (size > PERSIST_DATA_MAX_LENGTH)
+    size = PERSIST_DATA_MAX_LENGTH;
+
+  size_t used = size;
+  for (int i = 0; i < PERSIST_KEYS; i++) {
+    if (&persist[i] != slot)
+      used += persist[i].length;
+  }
+  if (used > PERSIST_BUDGET)
+    return E_OUT_OF_STORAGE;
+
+  slot->used = true;
+  slot->length = size;
+  memcpy(slot->data, data, size);
+  persist_save();
+  return size;
+}
+
+status_t persist_write_int(uint32_t key, int32_t value) {
+  return persist_write_data(key, &value, sizeof(value)) < 0 ? E_ERROR : S_SUCCESS;
+}
+
+status_t persist_delete(uint32_t key) {
+  PersistSlot *slot = persist_slot(key);
+  if (slot == NULL || !slot->used)
+    return E_DOES_NOT_EXIST;
+
+  memset(slot, 0, sizeof(PersistSlot));
+  persist_save();
+  return S_SUCCESS;
+}
+
+// Dictionaries
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+  Tuple *tuple = iter->dictionary->head;
+  for (int i = 0; i < iter->dictionary->count; i++) {
+    if (tuple->key == key)
+      return tuple;
+    tuple = (Tuple *)((uint8_t *)tuple + sizeof(Tuple) + tuple->length);
+  }
+  return NULL;
+}
+
+static DictionaryResult dict_write(DictionaryIterator *iter, uint32_t key, TupleType type, const void *data, uint16_t length) {
+  if ((uint8_t *)iter->cursor + sizeof(Tuple) + length > (uint8_t *)iter->end)
+    return DICT_NOT_ENOUGH_STORAGE;
+
+  iter->cursor->key = key;
+  iter->cursor->type = type;
+  iter->cursor->length = length;
+  memcpy(iter->cursor->value->data, data, length);
+  iter->cursor = (Tuple *)((uint8_t *)iter->cursor + sizeof(Tuple) + length);
+  iter->dictionary->count++;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data, const uint16_t size) {
+  return dict_write(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char * const cstring) {
+  return dict_write(iter, key, TUPLE_CSTRING, cstring, strlen(cstring) + 1);
+}
+
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value) {
+  return dict_write(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+  return dict_write(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+  return dict_write(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+  iter->end = iter->cursor;
+  return (uint8_t *)iter->cursor - (uint8_t *)iter->dictionary;
+}
+
+// AppMessage
+
+static AppMessageInboxReceived inbox_received;
+static AppMessageInboxDropped inbox_dropped;
+static AppMessageOutboxSent outbox_sent;
+static AppMessageOutboxFailed outbox_failed;
+
+static uint8_t *outbox;
+static uint32_t inbox_size;
+static uint32_t outbox_size;
+static DictionaryIterator outbox_iter;
+static bool outbox_open;
+static bool outbox_in_flight;
+
+uint32_t sim_inbox_maximum = 8200;
+uint32_t sim_outbox_maximum = 8200;
+
+uint32_t app_message_inbox_size_maximum(void) {
+  return sim_inbox_maximum;
+}
+
+uint32_t app_message_outbox_size_maximum(void) {
+  return sim_outbox_maximum;
+}
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+  if (size_inbound > sim_inbox_maximum || size_outbound > sim_outbox_maximum)
+    return APP_MSG_INVALID_ARGS;
+
+  inbox_size = size_inbound;
+  outbox_size = size_outbound;
+  free(outbox);
+  outbox = malloc(outbox_size);
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+  *iterator = NULL;
+  if (outbox == NULL)
+    return APP_MSG_INVALID_ARGS;
+  if (outbox_open || outbox_in_flight)
+    return APP_MSG_BUSY;
+
+  outbox_iter.dictionary = (Dictionary *)outbox;
+  outbox_iter.dictionary->count = 0;
+  outbox_iter.cursor = outbox_iter.dictionary->head;
+  outbox_iter.end = outbox + outbox_size;
+  outbox_open = true;
+  *iterator = &outbox_iter;
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void) {
+  if (!outbox_open)
+    return APP_MSG_INVALID_ARGS;
+
+  outbox_open = false;
+  outbox_in_flight = true;
+  sim_send((const uint8_t *)outbox_iter.dictionary, (uint8_t *)outbox_iter.cursor - outbox);
+  return APP_MSG_OK;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+  AppMessageInboxReceived previous = inbox_received;
+  inbox_received = received_callback;
+  return previous;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback) {
+  AppMessageInboxDropped previous = inbox_dropped;
+  inbox_dropped = dropped_callback;
+  return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+  AppMessageOutboxSent previous = outbox_sent;
+  outbox_sent = sent_callback;
+  return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+  AppMessageOutboxFailed previous = outbox_failed;
+  outbox_failed = failed_callback;
+  return previous;
+}
+
+bool sim_receive(const uint8_t *data, size_t length) {
+  if (length > inbox_size || inbox_received == NULL) {
+    if (inbox_dropped)
+      inbox_dropped(APP_MSG_BUFFER_OVERFLOW, NULL);
+    return false;
+  }
+
+  uint8_t *inbox = malloc(length);
+  memcpy(inbox, data, length);
+  DictionaryIterator iter = {
+    .dictionary = (Dictionary *)inbox,
+    .end = inbox + length,
+    .cursor = ((Dictionary *)inbox)->head,
+  };
+  inbox_received(&iter, NULL);
+  free(inbox);
+  return true;
+}
+
+void sim_outbox_done(AppMessageResult result) {
+  if (!outbox_in_flight)
+    return;
+
+  outbox_in_flight = false;
+  if (result == APP_MSG_OK) {
+    if (outbox_sent)
+      outbox_sent(&outbox_iter, NULL);
+  } else if (outbox_failed) {
+    outbox_failed(&outbox_iter, result, NULL);
+  }
+}
+
+// Timers and time
+
+#define MAX_TIMERS 32
+
+struct AppTimer {
+  bool active;
+  uint32_t due;
+  AppTimerCallback callback;
+  void *data;
+};
+
+static AppTimer timers[MAX_TIMERS];
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  for (int i = 0; i < MAX_TIMERS; i++) {
+    if (!timers[i].active) {
+      timers[i] = (AppTimer) { true, sim_now_ms + timeout_ms, callback, callback_data };
+      return &timers[i];
+    }
+  }
+  APP_LOG(APP_LOG_LEVEL_ERROR, "Out of timers");
+  return NULL;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+  if (timer_handle)
+    timer_handle->active = false;
+}
+
+static AppTimer *next_timer(void) {
+  AppTimer *next = NULL;
+  for (int i = 0; i < MAX_TIMERS; i++) {
+    if (timers[i].active && (next == NULL || timers[i].due < next->due))
+      next = &timers[i];
+  }
+  return next;
+}
+
+void sim_fire_timers(void) {
+  AppTimer *timer;
+  while ((timer = next_timer()) != NULL && timer->due <= sim_now_ms) {
+    timer->active = false;
+    timer->callback(timer->data);
+  }
+}
+
+int64_t sim_next_timer(void) {
+  AppTimer *timer = next_timer();
+  return timer ? (int64_t)timer->due : -1;
+}
+
+time_t sim_time(time_t *tloc) {
+  time_t now = SIM_EPOCH + sim_now_ms / 1000;
+  if (tloc)
+    *tloc = now;
+  return now;
+}
+
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms) {
+  uint16_t ms = sim_now_ms % 1000;
+  if (t_utc)
+    sim_time(t_utc);
+  if (out_ms)
+    *out_ms = ms;
+  return ms;
+}
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler) {}
+void tick_timer_service_unsubscribe(void) {}
+
+// UI
+
+GColor GColorFromHEX(uint32_t hex) {
+  return (GColor) { 0xC0 | ((hex >> 22) & 0x30) | ((hex >> 12) & 0x0C) | ((hex >> 6) & 0x03) };
+}
+
+void fonts_unload_custom_font(GFont font) {}
+void window_stack_pop_all(const bool animated) {}
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame) { return NULL; }
+void property_animation_destroy(PropertyAnimation *property_animation) {}
+bool animation_set_duration(Animation *animation, uint32_t duration_ms) { return true; }
+bool animation_set_curve(Animation *animation, AnimationCurve curve) { return true; }
+bool animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) { return true; }
+bool animation_schedule(Animation *animation) { return true; }
+void animation_unschedule_all(void) {}
+void app_event_loop(void) {}
@@ -0,0 +1,22 @@
+//
+// Hooks between fake_pebble.c and the simulator driver.
+//
+
+#pragma once
+#include "pebble.h"
+
+#define SIM_EPOCH 1500000000
+
+extern uint32_t sim_now_ms;
+extern bool sim_verbose;
+extern uint32_t sim_inbox_maximum;
+extern uint32_t sim_outbox_maximum;
+
+void sim_persist_open(const char *path);
+bool sim_receive(const uint8_t *data, size_t length);
+void sim_outbox_done(AppMessageResult result);
+void sim_fire_timers(void);
+int64_t sim_next_timer(void);
+
+// Implemented by the driver, called when the watch sends a message
+void sim_send(const uint8_t *data, size_t length);
@@ -0,0 +1,514 @@
+#!/usr/bin/env node
+//
+// Sync simulator. Runs src/pkjs/app.js under Node against the watch code
+// built by the Makefile (sim_watch), joined by a simulated Bluetooth link
+// with latency, packet loss and an MTU. Time is simulated, so a run is
+// repeatable for a given seed and takes no real time.
+//
+//   node tools/sim/sim.js --accounts 30 --drop 0.02 --runs 10
+//
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var child_process = require('child_process');
+
+var ROOT = path.join(__dirname, '..', '..');
+var BASE32_ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+var FIRST_MESSAGE_KEY = 10000;
+var TUPLE_HEADER_SIZE = 7;
+
+var TUPLE_BYTE_ARRAY = 0;
+var TUPLE_CSTRING = 1;
+var TUPLE_UINT = 2;
+var TUPLE_INT = 3;
+
+var APP_MSG_SEND_TIMEOUT = 2;
+
+var OPTIONS = {
+	accounts: [30, "keys on the phone"],
+	"watch-keys": [0, "keys already synced to the watch by an earlier launch"],
+	relabel: [0, "of those, how many were relabelled on the phone since"],
+	duplicates: [0, "of the accounts, how many repeat an earlier one's secret"],
+	"secret-chars": [0, "base32 characters per secret, 0 for a mix of 16, 24 and 32"],
+	latency: [40, "one way link latency in ms"],
+	"packet-ms": [8, "time to send each packet in ms"],
+	mtu: [158, "bytes per packet"],
+	drop: [0, "chance of losing each packet"],
+	timeout: [1500, "ms before an unacknowledged message fails"],
+	inbox: [8200, "largest inbox the watch can open, 750 on aplite"],
+	seed: [1, "random seed"],
+	runs: [1, "runs to average, each with the next seed"]
+};
+
+function parseOptions(argv) {
+	var options = { verbose: false, keysHeader: false };
+	for (var name in OPTIONS)
+		options[name] = OPTIONS[name][0];
+
+	for (var i = 0; i < argv.length; i++) {
+		var arg = argv[i];
+		if (arg == "--verbose") {
+			options.verbose = true;
+		} else if (arg == "--keys-header") {
+			options.keysHeader = true;
+		} else if (arg.substring(0, 2) == "--" && arg.substring(2) in OPTIONS && i + 1 < argv.length) {
+			options[arg.substring(2)] = parseFloat(argv[++i]);
+		} else {
+			console.log("Usage: node sim.js [options]\n");
+			for (var option in OPTIONS)
+				console.log("  --" + option + " N  " + OPTIONS[option][1] + " (" + OPTIONS[option][0] + ")");
+			console.log("  --verbose     log every message and watch log line");
+			process.exit(arg == "--help" ? 0 : 1);
+		}
+	}
+	return options;
+}
+
+// Message keys are numbered the way the SDK does it, in package.json order
+// with arrays taking one number per element
+function messageKeys() {
+	var names = JSON.parse(fs.readFileSync(path.join(ROOT, 'package.json'), 'utf8')).pebble.messageKeys;
+	var keys = {};
+	var next = FIRST_MESSAGE_KEY;
+	names.forEach(function(name) {
+		var array = /^(\w+)\[(\d+)\]$/.exec(name);
+		keys[array ? array[1] : name] = next;
+		next += array ? parseInt(array[2]) : 1;
+	});
+	return keys;
+}
+
+function keysHeader(keys) {
+	var lines = ["// Generated by sim.js from package.json", "#pragma once", ""];
+	for (var name in keys)
+		lines.push("#define MESSAGE_KEY_" + name + " " + keys[name]);
+	return lines.join("\n") + "\n";
+}
+
+function random(seed) {
+	return function() {
+		seed = (seed + 0x6D2B79F5) | 0;
+		var t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+		t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+		return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+	};
+}
+
+// Dictionaries in the watch's wire layout: a count byte, then per tuple a
+// 32-bit key, a type byte, a 16-bit length and the value
+function serialize(dict) {
+	var tuples = [];
+	for (var key in dict) {
+		var value = dict[key];
+		var type, bytes;
+		if (typeof value == "string") {
+			type = TUPLE_CSTRING;
+			bytes = Array.from(Buffer.from(value + "\0", "utf8"));
+		} else if (Array.isArray(value)) {
+			type = TUPLE_BYTE_ARRAY;
+			bytes = value;
+		} else {
+			type = TUPLE_INT;
+			var buffer = Buffer.alloc(4);
+			buffer.writeInt32LE(value | 0);
+			bytes = Array.from(buffer);
+		}
+		var header = Buffer.alloc(TUPLE_HEADER_SIZE);
+		header.writeUInt32LE(parseInt(key), 0);
+		header.writeUInt8(type, 4);
+		header.writeUInt16LE(bytes.length, 5);
+		tuples.push(header, Buffer.from(bytes));
+	}
+	return Buffer.concat([Buffer.from([tuples.length / 2])].concat(tuples));
+}
+
+function deserialize(buffer, keyNames) {
+	var payload = {};
+	var offset = 1;
+	for (var i = 0; i < buffer[0]; i++) {
+		var key = buffer.readUInt32LE(offset);
+		var type = buffer[offset + 4];
+		var length = buffer.readUInt16LE(offset + 5);
+		var data = buffer.slice(offset + TUPLE_HEADER_SIZE, offset + TUPLE_HEADER_SIZE + length);
+		var value;
+		if (type == TUPLE_CSTRING)
+			value = data.toString("utf8").replace(/\0.*$/, "");
+		else if (type == TUPLE_BYTE_ARRAY)
+			value = Array.from(data);
+		else if (type == TUPLE_UINT)
+			value = length == 1 ? data.readUInt8(0) : length == 2 ? data.readUInt16LE(0) : data.readUInt32LE(0);
+		else
+			value = length == 1 ? data.readInt8(0) : length == 2 ? data.readInt16LE(0) : data.readInt32LE(0);
+		payload[key] = value;
+		if (keyNames[key])
+			payload[keyNames[key]] = value;
+		offset += TUPLE_HEADER_SIZE + length;
+	}
+	return payload;
+}
+
+// Discrete event clock shared by both ends
+function Clock() {
+	this.now = 0;
+	this.events = [];
+	this.sequence = 0;
+}
+
+Clock.prototype.at = function(delay, action) {
+	var event = { time: this.now + Math.max(0, delay), sequence: this.sequence++, action: action };
+	this.events.push(event);
+	return event;
+};
+
+Clock.prototype.cancel = function(event) {
+	var index = this.events.indexOf(event);
+	if (index != -1)
+		this.events.splice(index, 1);
+};
+
+Clock.prototype.run = async function(limit) {
+	while (this.events.length > 0) {
+		this.events.sort(function(a, b) { return a.time - b.time || a.sequence - b.sequence; });
+		var event = this.events.shift();
+		if (event.time > limit)
+			break;
+		this.now = event.time;
+		await event.action();
+	}
+};
+
+// The watch binary, one command and reply at a time
+function Watch(sim, persistPath) {
+	var args = ["--persist", persistPath, "--inbox", String(sim.options.inbox)];
+	if (sim.options.verbose)
+		args.push("--verbose");
+
+	this.sim = sim;
+	this.process = child_process.spawn(path.join(__dirname, "sim_watch"), args, { stdio: ["pipe", "pipe", "inherit"] });
+	this.buffer = "";
+	this.waiting = null;
+	this.timer = null;
+
+	var watch = this;
+	this.process.stdout.on("data", function(chunk) {
+		watch.buffer += chunk.toString();
+		var end = watch.buffer.indexOf("\n.\n");
+		if (end != -1 && watch.waiting) {
+			var lines = watch.buffer.substring(0, end).split("\n");
+			watch.buffer = watch.buffer.substring(end + 3);
+			var resolve = watch.waiting;
+			watch.waiting = null;
+			resolve(lines);
+		}
+	});
+}
+
+Watch.prototype.raw = function(command) {
+	var watch = this;
+	return new Promise(function(resolve) {
+		watch.waiting = resolve;
+		watch.process.stdin.write(command + "\n");
+	});
+};
+
+Watch.prototype.command = async function(command) {
+	await this.raw("time " + this.sim.clock.now);
+	var lines = await this.raw(command);
+	var reply = { nack: false, state: null };
+
+	for (var i = 0; i < lines.length; i++) {
+		var words = lines[i].split(" ");
+		if (words[0] == "send")
+			this.sim.watchSent(Buffer.from(words[1], "hex"));
+		else if (words[0] == "nack")
+			reply.nack = true;
+		else if (words[0] == "state")
+			reply.state = { count: parseInt(words[1]), digest: parseInt(words[2]) };
+		else if (words[0] == "next")
+			this.schedule(parseInt(words[1]));
+		else if (words[0] == "log")
+			console.log("  watch " + lines[i].substring(4));
+	}
+	return reply;
+};
+
+Watch.prototype.schedule = function(due) {
+	if (this.timer)
+		this.sim.clock.cancel(this.timer);
+	this.timer = null;
+
+	if (due >= 0) {
+		var watch = this;
+		this.timer = this.sim.clock.at(due - this.sim.clock.now, function() {
+			watch.timer = null;
+			return watch.sim.watchCommand("fire");
+		});
+	}
+};
+
+Watch.prototype.quit = async function() {
+	if (this.timer)
+		this.sim.clock.cancel(this.timer);
+	await this.command("deinit");
+	this.process.stdin.end("quit\n");
+};
+
+// app.js in a fresh sandbox with its own Pebble object and timers
+function Phone(sim, storage) {
+	var phone = this;
+	this.handlers = {};
+	this.transaction = 0;
+	this.ready = false;
+
+	var Pebble = {
+		addEventListener: function(name, handler) {
+			phone.handlers[name] = handler;
+		},
+		sendAppMessage: function(dict, success, failure) {
+			sim.phoneSent(dict, ++phone.transaction, success, failure);
+		},
+		getActiveWatchInfo: function() {
+			return { firmware: { major: 4, minor: 3, patch: 0, suffix: "" } };
+		}
+	};
+	var localStorage = {
+		getItem: function(key) { return key in storage ? storage[key] : null; },
+		setItem: function(key, value) { storage[key] = String(value); },
+		removeItem: function(key) { delete storage[key]; }
+	};
+	var setTimeout = function(callback, delay) {
+		return sim.clock.at(delay || 0, function() { callback(); });
+	};
+	var require = function(name) {
+		if (name == "message_keys")
+			return sim.keys;
+		if (name == "pebble-clay")
+			return function() { this.setSettings = function() {}; this.getSettings = function() { return {}; }; };
+		return {};
+	};
+	var quiet = { log: sim.options.verbose ? function(text) { console.log("  phone " + text); } : function() {} };
+
+	var source = fs.readFileSync(path.join(ROOT, "src", "pkjs", "app.js"), "utf8");
+	var app = new Function("require", "module", "Pebble", "localStorage", "setTimeout", "console",
+		source + "\nreturn { tableDigest: tableDigest };");
+	this.app = app(require, {}, Pebble, localStorage, setTimeout, quiet);
+}
+
+Phone.prototype.emit = function(name, event) {
+	if (this.handlers[name])
+		this.handlers[name](event);
+};
+
+function Simulator(options, keys) {
+	this.options = options;
+	this.keys = keys;
+	this.keyNames = {};
+	for (var name in keys)
+		this.keyNames[keys[name]] = name;
+	this.random = random(options.seed);
+	this.clock = new Clock();
+	this.stats = null;
+}
+
+// Returns how long a message takes to arrive, or -1 if a packet was lost
+Simulator.prototype.transfer = function(bytes) {
+	var packets = Math.ceil(bytes / this.options.mtu);
+	this.stats.packets += packets;
+	for (var i = 0; i < packets; i++) {
+		if (this.random() < this.options.drop) {
+			this.stats.drops++;
+			return -1;
+		}
+	}
+	return this.options.latency + packets * this.options["packet-ms"];
+};
+
+Simulator.prototype.describe = function(direction, buffer) {
+	if (this.options.verbose) {
+		var payload = deserialize(buffer, this.keyNames);
+		var names = Object.keys(payload).filter(function(key) { return isNaN(key); });
+		console.log(this.clock.now + "ms " + direction + " " + buffer.length + " bytes: " + names.join(", "));
+	}
+};
+
+Simulator.prototype.phoneSent = function(dict, transaction, success, failure) {
+	var sim = this;
+	var buffer = serialize(dict);
+	this.stats.phoneMessages++;
+	this.stats.phoneBytes += buffer.length;
+	this.describe("phone > watch", buffer);
+
+	var event = { data: { transactionId: transaction }, error: { message: "" } };
+	var delay = this.transfer(buffer.length);
+	if (delay < 0) {
+		this.clock.at(this.options.timeout, function() { sim.stats.failures++; failure(event); });
+		return;
+	}
+
+	this.clock.at(delay, async function() {
+		var reply = await sim.watchCommand("recv " + buffer.toString("hex"));
+		sim.clock.at(sim.options.latency, function() {
+			if (reply.nack) {
+				sim.stats.failures++;
+				failure(event);
+			} else {
+				success(event);
+			}
+		});
+	});
+};
+
+Simulator.prototype.watchSent = function(buffer) {
+	var sim = this;
+	this.stats.watchMessages++;
+	this.stats.watchBytes += buffer.length;
+	this.describe("watch > phone", buffer);
+
+	var delay = this.transfer(buffer.length);
+	if (delay < 0) {
+		this.clock.at(this.options.timeout, function() {
+			sim.stats.failures++;
+			return sim.watchCommand("failed " + APP_MSG_SEND_TIMEOUT);
+		});
+		return;
+	}
+
+	this.clock.at(delay, function() {
+		sim.stats.roundTrips++;
+		sim.phone.emit("appmessage", { payload: deserialize(buffer, sim.keyNames) });
+		sim.clock.at(sim.options.latency, function() { return sim.watchCommand("sent"); });
+	});
+};
+
+// Runs a watch command then checks whether both ends now hold the same keys
+Simulator.prototype.watchCommand = async function(command) {
+	var reply = await this.watch.command(command);
+	if (this.phone.ready && this.stats.syncedAt < 0) {
+		var state = (await this.watch.command("state")).state;
+		if (state.digest == this.phone.app.tableDigest())
+			this.stats.syncedAt = this.clock.now;
+	}
+	return reply;
+};
+
+// One app launch, from both ends starting until there is nothing left to do
+Simulator.prototype.launch = async function(storage, persistPath) {
+	var sim = this;
+	this.clock = new Clock();
+	this.stats = {
+		phoneMessages: 0, phoneBytes: 0, watchMessages: 0, watchBytes: 0,
+		packets: 0, drops: 0, failures: 0, roundTrips: 0, syncedAt: -1
+	};
+
+	this.watch = new Watch(this, persistPath);
+	this.phone = new Phone(this, storage);
+
+	await this.watchCommand("init");
+	this.clock.at(this.options.latency, function() {
+		sim.phone.ready = true;
+		sim.phone.emit("ready", {});
+	});
+	await this.clock.run(10 * 60 * 1000);
+	await this.watch.quit();
+
+	return this.stats;
+};
+
+// The last duplicates accounts reuse the secrets of the first ones, in lower
+// case so they only match once decoded
+function makeAccounts(count, duplicates, secretChars, rand) {
+	var accounts = [];
+	for (var i = 0; i < count; i++) {
+		if (i >= count - duplicates) {
+			accounts.push({ label: "Account " + (i + 1), secret: accounts[i - (count - duplicates)].secret.toLowerCase() });
+			continue;
+		}
+		var length = secretChars || 16 + Math.floor(rand() * 3) * 8;
+		var secret = "";
+		for (var j = 0; j < length; j++)
+			secret += BASE32_ALPHABET.charAt(Math.floor(rand() * 32));
+		accounts.push({ label: "Account " + (i + 1), secret: secret });
+	}
+	return accounts;
+}
+
+function storePhoneKeys(storage, accounts) {
+	for (var i = 0; i < 100; i++)
+		delete storage["secret_pair" + i];
+	accounts.forEach(function(account, i) {
+		storage["secret_pair" + i] = account.label + ":" + account.secret;
+	});
+}
+
+async function simulate(options, keys, seed) {
+	var sim = new Simulator(Object.assign({}, options, { seed: seed }), keys);
+	var accounts = makeAccounts(options.accounts, options.duplicates, options["secret-chars"], random(seed * 7919));
+	var persistPath = path.join(os.tmpdir(), "pebbauth-sim-" + process.pid + "-" + seed);
+	var storage = {};
+
+	try {
+		fs.unlinkSync(persistPath);
+	} catch (e) {}
+
+	// An earlier launch that left some keys on the watch
+	var watchKeys = Math.min(options["watch-keys"], accounts.length);
+	if (watchKeys > 0) {
+		storePhoneKeys(storage, accounts.slice(0, watchKeys));
+		await sim.launch(storage, persistPath);
+		for (var i = 0; i < Math.min(options.relabel, watchKeys); i++)
+			accounts[i].label += " (new)";
+	}
+
+	storePhoneKeys(storage, accounts);
+	var stats = await sim.launch(storage, persistPath);
+	fs.unlinkSync(persistPath);
+	return stats;
+}
+
+function report(results) {
+	var columns = [
+		["synced ms", "syncedAt"], ["round trips", "roundTrips"],
+		["phone msgs", "phoneMessages"], ["phone bytes", "phoneBytes"],
+		["watch msgs", "watchMessages"], ["watch bytes", "watchBytes"],
+		["packets", "packets"], ["drops", "drops"], ["failures", "failures"]
+	];
+	var pad = function(text) { return ("            " + text).slice(-12); };
+
+	console.log(columns.map(function(column) { return pad(column[0]); }).join(""));
+	results.forEach(function(stats) {
+		console.log(columns.map(function(column) { return pad(stats[column[1]]); }).join(""));
+	});
+
+	if (results.length > 1) {
+		var synced = results.filter(function(stats) { return stats.syncedAt >= 0; });
+		console.log(columns.map(function(column) {
+			var source = column[1] == "syncedAt" ? synced : results;
+			var total = source.reduce(function(sum, stats) { return sum + stats[column[1]]; }, 0);
+			return pad(source.length ? (total / source.length).toFixed(1) : "-");
+		}).join("") + "  mean");
+		if (synced.length < results.length)
+			console.log((results.length - synced.length) + " of " + results.length + " runs never synced");
+	}
+}
+
+async function main() {
+	var options = parseOptions(process.argv.slice(2));
+	var keys = messageKeys();
+
+	if (options.keysHeader) {
+		process.stdout.write(keysHeader(keys));
+		return;
+	}
+
+	console.log(options.accounts + " accounts, " + options["watch-keys"] + " on the watch, " +
+		options.relabel + " relabelled, " + options.latency + "ms latency, " + options.mtu + " byte MTU, " +
+		(options.drop * 100) + "% packet loss, " + options.inbox + " byte inbox");
+
+	var results = [];
+	for (var run = 0; run < options.runs; run++)
+		results.push(await simulate(options, keys, options.seed + run));
+	report(results);
+}
+
+main();
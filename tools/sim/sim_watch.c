@@ -0,0 +1,96 @@
+//
+// Watch side of the sync simulator. Runs the real main.c against
+// fake_pebble.c and takes one command per line on stdin from sim.js:
+//
+//   time <ms>      set the clock
+//   init / deinit  start or stop the app
+//   recv <hex>     deliver a message from the phone, replies "nack" if dropped
+//   sent           the last outgoing message was acknowledged
+//   failed <code>  the last outgoing message failed with an AppMessageResult
+//   fire           run any app timers that are due
+//   state          print the key count and table digest
+//
+// Each reply ends with "next <ms>", the time the next timer is due or -1,
+// and a line holding a single "." Messages the watch sends in between are
+// printed as "send <hex>".
+//
+
+#include <stdlib.h>
+#include "pebble.h"
+#include "fake_pebble.h"
+#include "main.h"
+#include "key_store.h"
+
+void handle_init(void);
+void handle_deinit(void);
+
+// The windows and their fonts are not simulated
+void single_code_window_push(void) {}
+void single_code_window_remove(void) {}
+void single_code_window_second_tick(int seconds) {}
+void multi_code_window_push(void) {}
+void multi_code_window_remove(void) {}
+void multi_code_window_second_tick(int seconds) {}
+void font_manager_unload(void) {}
+
+void sim_send(const uint8_t *data, size_t length) {
+  printf("send ");
+  for (size_t i = 0; i < length; i++)
+    printf("%02x", data[i]);
+  printf("\n");
+}
+
+static size_t from_hex(const char *hex, uint8_t *data, size_t size) {
+  size_t length = 0;
+  unsigned int byte;
+  while (length < size && sscanf(hex + length * 2, "%2x", &byte) == 1)
+    data[length++] = byte;
+  return length;
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--persist") == 0 && i + 1 < argc)
+      sim_persist_open(argv[++i]);
+    else if (strcmp(argv[i], "--inbox") == 0 && i + 1 < argc)
+      sim_inbox_maximum = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--verbose") == 0)
+      sim_verbose = true;
+  }
+
+  static char line[65536];
+  static uint8_t message[32768];
+
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *argument = strchr(line, ' ');
+    if (argument)
+      *argument++ = '\0';
+
+    if (strcmp(line, "time") == 0) {
+      sim_now_ms = strtoul(argument, NULL, 10);
+    } else if (strcmp(line, "init") == 0) {
+      handle_init();
+    } else if (strcmp(line, "deinit") == 0) {
+      handle_deinit();
+    } else if (strcmp(line, "recv") == 0) {
+      if (!sim_receive(message, from_hex(argument, message, sizeof(message))))
+        printf("nack\n");
+    } else if (strcmp(line, "sent") == 0) {
+      sim_outbox_done(APP_MSG_OK);
+    } else if (strcmp(line, "failed") == 0) {
+      sim_outbox_done(atoi(argument));
+    } else if (strcmp(line, "fire") == 0) {
+      sim_fire_timers();
+    } else if (strcmp(line, "state") == 0) {
+      printf("state %u %u\n", watch_otp_count, (unsigned int)key_store_table_digest());
+    } else if (strcmp(line, "quit") == 0) {
+      break;
+    }
+
+    printf("next %lld\n.\n", (long long)sim_next_timer());
+    fflush(stdout);
+  }
+
+  return 0;
+}